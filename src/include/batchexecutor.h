@@ -0,0 +1,162 @@
+#ifndef BATCHEXECUTOR_H
+#define BATCHEXECUTOR_H
+#include "threadpoolfinal.h"
+
+/*
+批量执行器：
+大量很小的同类任务(比如逐条记录计算哈希)单独submitTask时，提交和调度的开销比任务本身还大
+BatchExecutor把提交的数据攒成一批，凑满batchSize或者等待超过linger之后作为一个任务交给线程池
+任务里面用一个紧凑的循环处理整批数据，handler是模板参数，编译器可以内联甚至向量化
+example:
+ThreadPool pool;
+pool.start(4);
+auto hash = [](const uint64_t& x) -> uint64_t {return x * 0x9E3779B97F4A7C15ULL;};
+BatchExecutor<uint64_t,uint64_t,decltype(hash)> executor(pool,hash);
+BatchResult<uint64_t> r = executor.submit(42);
+uint64_t h = r.get();
+*/
+template<typename In,typename Out>
+struct Batch {
+    Batch(size_t capacity):ready(done.get_future().share()) {
+        in.reserve(capacity);
+    }
+    std::vector<In> in;
+    std::vector<Out> out;
+    std::promise<void> done;          //整批处理完成
+    std::shared_future<void> ready;
+};
+
+//单条数据的结果，引用所在的批次，get()等待整批处理完成
+template<typename Out>
+class BatchResult {
+public:
+    template<typename In>
+    BatchResult(std::shared_ptr<Batch<In,Out>> batch,size_t index)
+        :ready_(batch -> ready),out_(std::shared_ptr<std::vector<Out>>(batch,&batch -> out)),index_(index) {}
+
+    //获取结果，批次没有处理完会阻塞，handler抛出的异常在这里重新抛出
+    Out get() {
+        ready_.get();
+        return (*out_)[index_];
+    }
+
+    //批次是否已经处理完
+    bool isReady() const {
+        return ready_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+private:
+    std::shared_future<void> ready_;
+    std::shared_ptr<std::vector<Out>> out_; //和批次共享所有权
+    size_t index_;
+};
+
+template<typename In,typename Out,typename Handler>
+class BatchExecutor {
+public:
+    //handler: Out(const In&)  batchSize: 一批最多的数据条数  linger: 一批数据最长的等待时间
+    BatchExecutor(ThreadPool& pool,Handler handler,size_t batchSize = 256,
+                  std::chrono::microseconds linger = std::chrono::microseconds(200))
+        :state_(std::make_shared<State>(pool,std::move(handler),std::max<size_t>(batchSize,1),linger)) {}
+
+    //析构时把没有凑满的批次也提交，已经返回的BatchResult仍然有效
+    ~BatchExecutor() {
+        flush();
+    }
+
+    //提交一条数据
+    BatchResult<Out> submit(In item) {
+        std::shared_ptr<Batch<In,Out>> full;
+        std::shared_ptr<Batch<In,Out>> batch;
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(state_ -> mtx);
+            if(state_ -> current == nullptr) {
+                state_ -> current = std::make_shared<Batch<In,Out>>(state_ -> batchSize);
+                state_ -> batchSeq++;
+                //新批次开始计时，linger之后还没有凑满就直接提交
+                std::weak_ptr<State> weak = state_;
+                unsigned long long seq = state_ -> batchSeq;
+                state_ -> pool.runAfter(state_ -> linger,[weak,seq]() {
+                    if(std::shared_ptr<State> state = weak.lock()) {
+                        state -> flushIf(seq);
+                    }
+                });
+            }
+            batch = state_ -> current;
+            index = batch -> in.size();
+            batch -> in.emplace_back(std::move(item));
+            if(batch -> in.size() == state_ -> batchSize) {
+                full = std::move(state_ -> current);
+                state_ -> current = nullptr;
+            }
+        }
+        if(full != nullptr) {
+            state_ -> dispatch(std::move(full));
+        }
+        return BatchResult<Out>(std::move(batch),index);
+    }
+
+    //立即提交当前没有凑满的批次
+    void flush() {
+        state_ -> flushIf(0);
+    }
+
+    BatchExecutor(const BatchExecutor&) = delete;
+    BatchExecutor& operator=(const BatchExecutor&) = delete;
+private:
+    //linger定时器可能在BatchExecutor析构之后触发，共享的状态用shared_ptr管理
+    struct State : std::enable_shared_from_this<State> {
+        State(ThreadPool& pool,Handler handler,size_t batchSize,std::chrono::microseconds linger)
+            :pool(pool),handler(std::move(handler)),batchSize(batchSize),linger(linger),batchSeq(0) {}
+
+        //提交序号为seq的批次，seq为0表示提交当前批次
+        void flushIf(unsigned long long seq) {
+            std::shared_ptr<Batch<In,Out>> batch;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                if(current == nullptr || (seq != 0 && seq != batchSeq)) {
+                    return;
+                }
+                batch = std::move(current);
+                current = nullptr;
+            }
+            dispatch(std::move(batch));
+        }
+
+        //整批数据作为一个任务交给线程池，不受任务队列上限的限制，避免数据丢失
+        void dispatch(std::shared_ptr<Batch<In,Out>> batch) {
+            std::shared_ptr<State> self = this -> shared_from_this();
+            pool.execute([self,batch]() {
+                try {
+                    self -> run(*batch);
+                    batch -> done.set_value();
+                }
+                catch(...) {
+                    batch -> done.set_exception(std::current_exception());
+                }
+            });
+        }
+
+        //紧凑的循环，连续的输入输出数组，handler可以被内联和向量化
+        void run(Batch<In,Out>& batch) {
+            size_t n = batch.in.size();
+            batch.out.resize(n);
+            const In* in = batch.in.data();
+            Out* out = batch.out.data();
+            for(size_t i = 0;i < n;i++) {
+                out[i] = handler(in[i]);
+            }
+        }
+
+        ThreadPool& pool;
+        Handler handler;
+        size_t batchSize;
+        std::chrono::microseconds linger;
+        std::mutex mtx;
+        std::shared_ptr<Batch<In,Out>> current; //正在攒的批次
+        unsigned long long batchSeq;            //批次序号，用来判断linger定时器对应的批次是否已经提交
+    };
+    std::shared_ptr<State> state_;
+};
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef FIBER_H
+#define FIBER_H
+#include <ucontext.h>
+#include <deque>
+#include <optional>
+#include "threadpoolfinal.h"
+
+const size_t FIBER_STACK_SIZE = 64 * 1024; // 协程栈大小
+const size_t FIBER_GUARD_SIZE = 4096;      // 协程栈保护页大小
+const int FIBER_AWAIT_MAX_BACKOFF = 100;   // 协程轮询std::future的最长间隔，单位：毫秒
+
+/*
+协程(M:N)：
+阻塞风格的任务放在协程里面执行，等待的时候挂起协程、让出工作线程，线程池的少量线程可以同时挂起大量的任务
+example:
+ThreadPool pool;
+pool.start(4);
+FiberFuture<int> r = submitFiber(pool,[]() -> int {
+    this_fiber::sleep_for(std::chrono::milliseconds(100)); //不占用线程
+    return 1;
+});
+int v = this_fiber::await(r); //在协程里面等待时挂起协程，在普通线程里面等待时阻塞线程
+*/
+class Fiber : public std::enable_shared_from_this<Fiber> {
+public:
+    Fiber(ThreadPool& pool,std::function<void()> func)
+        :pool_(pool),func_(std::move(func)),finished_(false) {
+        stack_ = StackCache::instance().allocate(FIBER_STACK_SIZE,FIBER_GUARD_SIZE);
+        getcontext(&ctx_);
+        ctx_.uc_stack.ss_sp = static_cast<char*>(stack_) + FIBER_GUARD_SIZE;
+        ctx_.uc_stack.ss_size = FIBER_STACK_SIZE;
+        ctx_.uc_link = nullptr;
+        //makecontext只能传int参数，把this指针拆成两半
+        uintptr_t ptr = reinterpret_cast<uintptr_t>(this);
+        makecontext(&ctx_,(void(*)())&Fiber::entry,2,(uint32_t)ptr,(uint32_t)(ptr >> 32));
+    }
+
+    ~Fiber() {
+        StackCache::instance().deallocate(stack_,FIBER_STACK_SIZE,FIBER_GUARD_SIZE);
+    }
+
+    //当前线程正在执行的协程，不在协程里面返回nullptr
+    //不能内联：协程恢复后可能换了线程，thread_local的地址不能被编译器缓存
+    __attribute__((noinline)) static Fiber* current() {
+        return current_;
+    }
+
+    //在工作线程上执行协程，直到协程挂起或者结束
+    void resume() {
+        Fiber* prev = current_;
+        current_ = this;
+        swapcontext(&callerCtx_,&ctx_);
+        current_ = prev;
+        //协程的上下文已经保存好了，这时候才能让别的线程唤醒它
+        if(!finished_ && afterSwitch_) {
+            std::function<void()> after = std::move(afterSwitch_);
+            afterSwitch_ = nullptr;
+            after();
+        }
+    }
+
+    //挂起当前协程，回到工作线程后执行afterSwitch，在afterSwitch里面安排协程什么时候被唤醒
+    void suspend(std::function<void()> afterSwitch) {
+        afterSwitch_ = std::move(afterSwitch);
+        swapcontext(&ctx_,&callerCtx_);
+    }
+
+    //把协程交给线程池，由某个工作线程恢复执行
+    void schedule() {
+        std::shared_ptr<Fiber> self = shared_from_this();
+        pool_.execute([self]() {self -> resume();});
+    }
+
+    ThreadPool& pool() {
+        return pool_;
+    }
+
+    Fiber(const Fiber&) = delete;
+    Fiber& operator=(const Fiber&) = delete;
+private:
+    static void entry(uint32_t low,uint32_t high) {
+        Fiber* self = reinterpret_cast<Fiber*>((uintptr_t)low | ((uintptr_t)high << 32));
+        self -> func_();
+        self -> finished_ = true;
+        //回到最后一次resume的地方，协程不会再被恢复
+        swapcontext(&self -> ctx_,&self -> callerCtx_);
+    }
+private:
+    ThreadPool& pool_;
+    std::function<void()> func_;
+    std::function<void()> afterSwitch_;
+    ucontext_t ctx_;       //协程的上下文
+    ucontext_t callerCtx_; //恢复协程的工作线程的上下文
+    void* stack_;
+    bool finished_;
+    inline static thread_local Fiber* current_ = nullptr;
+};
+
+//协程互斥锁 锁被占用时挂起协程而不是阻塞线程，也可以在普通线程里面使用
+class FiberMutex {
+public:
+    FiberMutex():locked_(false),threadWaitSize_(0) {}
+
+    void lock() {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if(!locked_) {
+            locked_ = true;
+            return;
+        }
+        Fiber* self = Fiber::current();
+        if(self == nullptr) {
+            threadWaitSize_++;
+            cond_.wait(lock,[&]() -> bool {return !locked_;});
+            threadWaitSize_--;
+            locked_ = true;
+            return;
+        }
+        //mtx_要等协程切换出去之后才能释放，否则unlock可能在上下文保存之前就唤醒了这个协程
+        waiters_.push_back(self -> shared_from_this());
+        lock.release();
+        self -> suspend([this]() {mtx_.unlock();});
+        //被unlock唤醒时锁已经直接交给了当前协程
+    }
+
+    bool try_lock() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if(locked_) {
+            return false;
+        }
+        locked_ = true;
+        return true;
+    }
+
+    void unlock() {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if(waiters_.empty()) {
+            locked_ = false;
+            if(threadWaitSize_ > 0) {
+                cond_.notify_one();
+            }
+            return;
+        }
+        //锁直接交给等待的协程，locked_保持为true
+        std::shared_ptr<Fiber> next = std::move(waiters_.front());
+        waiters_.pop_front();
+        lock.unlock();
+        next -> schedule();
+    }
+
+    FiberMutex(const FiberMutex&) = delete;
+    FiberMutex& operator=(const FiberMutex&) = delete;
+private:
+    std::mutex mtx_;
+    std::condition_variable cond_; //普通线程在这里等待
+    bool locked_;
+    int threadWaitSize_;
+    std::deque<std::shared_ptr<Fiber>> waiters_;
+};
+
+//FiberPromise和FiberFuture共享的状态
+template<typename T>
+struct FiberSharedState {
+    using Value = std::conditional_t<std::is_void<T>::value,char,T>;
+    std::mutex mtx;
+    std::condition_variable cond; //普通线程在这里等待
+    bool ready = false;
+    std::optional<Value> value;
+    std::exception_ptr error;
+    std::deque<std::shared_ptr<Fiber>> waiters; //挂起等待结果的协程
+};
+
+//协程版本的future 结果没有准备好时get()挂起协程而不是阻塞线程，也可以在普通线程里面使用
+template<typename T>
+class FiberFuture {
+public:
+    FiberFuture() = default;
+    explicit FiberFuture(std::shared_ptr<FiberSharedState<T>> state):state_(std::move(state)) {}
+
+    bool valid() const {
+        return state_ != nullptr;
+    }
+
+    bool isReady() {
+        std::lock_guard<std::mutex> lock(state_ -> mtx);
+        return state_ -> ready;
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(state_ -> mtx);
+        if(state_ -> ready) {
+            return;
+        }
+        Fiber* self = Fiber::current();
+        if(self == nullptr) {
+            state_ -> cond.wait(lock,[&]() -> bool {return state_ -> ready;});
+            return;
+        }
+        //和FiberMutex一样，mtx要等协程切换出去之后才能释放，完成时由setValue/setException唤醒
+        state_ -> waiters.push_back(self -> shared_from_this());
+        lock.release();
+        std::shared_ptr<FiberSharedState<T>> state = state_;
+        self -> suspend([state]() {state -> mtx.unlock();});
+    }
+
+    //只能调用一次，之后future不再有效
+    T get() {
+        wait();
+        std::shared_ptr<FiberSharedState<T>> state = std::move(state_);
+        if(state -> error) {
+            std::rethrow_exception(state -> error);
+        }
+        if constexpr(!std::is_void<T>::value) {
+            return std::move(*state -> value);
+        }
+    }
+private:
+    std::shared_ptr<FiberSharedState<T>> state_;
+};
+
+//协程版本的promise 设置结果时把等待的协程交给线程池恢复执行
+//没有设置结果就析构时，future抛出broken_promise
+template<typename T>
+class FiberPromise {
+public:
+    FiberPromise():state_(std::make_shared<FiberSharedState<T>>()) {}
+
+    ~FiberPromise() {
+        if(state_ != nullptr && !state_ -> ready) {
+            setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+
+    FiberFuture<T> getFuture() {
+        return FiberFuture<T>(state_);
+    }
+
+    //T为void时不带参数
+    template<typename... Args>
+    void setValue(Args&&... args) {
+        std::unique_lock<std::mutex> lock(state_ -> mtx);
+        state_ -> value.emplace(std::forward<Args>(args)...);
+        finish(lock);
+    }
+
+    void setException(std::exception_ptr error) {
+        std::unique_lock<std::mutex> lock(state_ -> mtx);
+        state_ -> error = error;
+        finish(lock);
+    }
+
+    FiberPromise(FiberPromise&&) = default;
+    FiberPromise(const FiberPromise&) = delete;
+    FiberPromise& operator=(const FiberPromise&) = delete;
+private:
+    void finish(std::unique_lock<std::mutex>& lock) {
+        state_ -> ready = true;
+        std::deque<std::shared_ptr<Fiber>> waiters = std::move(state_ -> waiters);
+        state_ -> waiters.clear();
+        state_ -> cond.notify_all();
+        lock.unlock();
+        for(auto& fiber : waiters) {
+            fiber -> schedule();
+        }
+    }
+private:
+    std::shared_ptr<FiberSharedState<T>> state_;
+};
+
+//协程版本的this_thread 不在协程里面调用时退化成线程的操作
+namespace this_fiber {
+
+//让出工作线程，协程重新排到任务队列的末尾
+inline void yield() {
+    Fiber* self = Fiber::current();
+    if(self == nullptr) {
+        std::this_thread::yield();
+        return;
+    }
+    self -> suspend([self]() {self -> schedule();});
+}
+
+//挂起协程，由线程池的定时器唤醒
+template<typename Rep,typename Period>
+void sleep_for(const std::chrono::duration<Rep,Period>& duration) {
+    Fiber* self = Fiber::current();
+    if(self == nullptr) {
+        std::this_thread::sleep_for(duration);
+        return;
+    }
+    auto when = ThreadPool::Clock::now() + std::chrono::duration_cast<ThreadPool::Clock::duration>(duration);
+    self -> suspend([self,when]() {
+        std::shared_ptr<Fiber> sp = self -> shared_from_this();
+        self -> pool().runAt(when,[sp]() {sp -> resume();});
+    });
+}
+
+//等待FiberFuture的结果，协程挂起到结果设置时才被唤醒，不轮询
+template<typename T>
+T await(FiberFuture<T>& future) {
+    return future.get();
+}
+
+//等待std::future的结果
+//std::future没有完成通知的接口，只能先yield几次，之后按指数退避sleep_for轮询，间隔最长FIBER_AWAIT_MAX_BACKOFF
+//协程之间传递结果应该用FiberPromise/FiberFuture
+template<typename T>
+T await(std::future<T>& future) {
+    if(Fiber::current() != nullptr) {
+        int spins = 0;
+        auto backoff = std::chrono::microseconds(50);
+        while(future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if(spins++ < 16) {
+                yield();
+            }
+            else {
+                sleep_for(backoff);
+                backoff = std::min<std::chrono::microseconds>(backoff * 2,std::chrono::milliseconds(FIBER_AWAIT_MAX_BACKOFF));
+            }
+        }
+    }
+    return future.get();
+}
+
+} // namespace this_fiber
+
+//把任务放到一个新的协程里面执行，返回值通过FiberFuture获取，其他协程可以用this_fiber::await挂起等待
+template<typename Func,typename... Args>
+auto submitFiber(ThreadPool& pool,Func&& func,Args&&... args) -> FiberFuture<decltype(func(args...))> {
+    using RType = decltype(func(args...));
+    auto promise = std::make_shared<FiberPromise<RType>>();
+    FiberFuture<RType> result = promise -> getFuture();
+    auto task = std::make_shared<decltype(std::bind(std::forward<Func>(func),std::forward<Args>(args)...))>(
+        std::bind(std::forward<Func>(func),std::forward<Args>(args)...));
+    auto fiber = std::make_shared<Fiber>(pool,[promise,task]() {
+        try {
+            if constexpr(std::is_void<RType>::value) {
+                (*task)();
+                promise -> setValue();
+            }
+            else {
+                promise -> setValue((*task)());
+            }
+        }
+        catch(...) {
+            promise -> setException(std::current_exception());
+        }
+    });
+    fiber -> schedule();
+    return result;
+}
+
+#endif
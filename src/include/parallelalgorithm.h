@@ -0,0 +1,345 @@
+#ifndef PARALLELALGORITHM_H
+#define PARALLELALGORITHM_H
+#include <iterator>
+#include <numeric>
+#include "threadpoolfinal.h"
+
+const size_t PARALLEL_BLOCK_BYTES = 256 * 1024; // 每个数据块的大小，按L2缓存估算
+const size_t PARALLEL_MIN_BLOCK = 1024;         // 每个数据块最少的元素个数
+const size_t PARALLEL_SORT_MIN_RUN = 16 * 1024; // 并行排序每段最少的元素个数
+
+/*
+并行算法：
+数据按缓存大小切块，块是调度的单位，调用线程和线程池的线程从同一个计数器领取数据块
+调用线程自己也处理数据块，所以在工作线程里面嵌套调用、任务被线程池拒绝都不会死锁
+块内是连续下标上的简单循环，便于编译器向量化
+example:
+ThreadPool pool;
+pool.start(4);
+std::vector<double> v(1 << 20,1.0);
+double sum = parallelTransformReduce(pool,v.begin(),v.end(),0.0,std::plus<double>(),[](double x) {return x * x;});
+parallelSort(pool,v.begin(),v.end());
+*/
+
+//parallelFor的共享状态，线程池里面的任务可能在调用返回之后才执行，用shared_ptr管理
+struct ParallelForState {
+    ParallelForState(size_t blocks,std::function<void(size_t)> body)
+        :blocks(blocks),body(std::move(body)),next(0),done(0),failed(false) {}
+
+    //领取数据块直到领完，body只在领到数据块时调用，这时调用线程一定还在等待
+    void run() {
+        size_t block;
+        while((block = next.fetch_add(1)) < blocks) {
+            if(!failed) {
+                try {
+                    body(block);
+                }
+                catch(...) {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    if(!failed.exchange(true)) {
+                        error = std::current_exception();
+                    }
+                }
+            }
+            if(done.fetch_add(1) + 1 == blocks) {
+                std::lock_guard<std::mutex> lock(mtx);
+                cond.notify_all();
+            }
+        }
+    }
+
+    size_t blocks;
+    std::function<void(size_t)> body;
+    std::atomic<size_t> next; //下一个要领取的数据块
+    std::atomic<size_t> done; //已经处理完的数据块
+    std::atomic<bool> failed;
+    std::exception_ptr error; //第一个异常，在调用线程重新抛出
+    std::mutex mtx;
+    std::condition_variable cond;
+};
+
+//参与计算的线程数：线程池的线程加上调用线程，线程池没有启动时只有调用线程
+//fork之后的子进程里面还没有重新创建线程时也按初始线程数量计算，execute提交帮手任务时会重新创建线程
+inline size_t parallelWorkers(const ThreadPool& pool) {
+    return (size_t)pool.getWorkerSize() + 1;
+}
+
+//并行执行body(block)，block取[0,blocks)，调用线程也参与，全部完成后返回
+template<typename Body>
+void parallelForBlocks(ThreadPool& pool,size_t blocks,Body&& body) {
+    if(blocks == 0) {
+        return;
+    }
+    if(blocks == 1) {
+        body(0);
+        return;
+    }
+    auto state = std::make_shared<ParallelForState>(blocks,[&body](size_t block) {body(block);});
+    size_t helpers = std::min(blocks - 1,parallelWorkers(pool) - 1);
+    for(size_t i = 0;i < helpers;i++) {
+        pool.execute([state]() {state -> run();});
+    }
+    state -> run();
+    {
+        std::unique_lock<std::mutex> lock(state -> mtx);
+        state -> cond.wait(lock,[&]() -> bool {return state -> done == state -> blocks;});
+    }
+    if(state -> error) {
+        std::rethrow_exception(state -> error);
+    }
+}
+
+//按元素大小计算数据块的元素个数
+template<typename T>
+size_t parallelBlockSize() {
+    return std::max(PARALLEL_MIN_BLOCK,PARALLEL_BLOCK_BYTES / sizeof(T));
+}
+
+//把[0,n)切成大小为grain的区间，并行执行func(begin,end)
+template<typename Func>
+void parallelFor(ThreadPool& pool,size_t n,size_t grain,Func&& func) {
+    grain = std::max<size_t>(grain,1);
+    size_t blocks = (n + grain - 1) / grain;
+    parallelForBlocks(pool,blocks,[&](size_t block) {
+        size_t begin = block * grain;
+        func(begin,std::min(begin + grain,n));
+    });
+}
+
+template<typename Iter,typename Func>
+void parallelForEach(ThreadPool& pool,Iter first,Iter last,Func func) {
+    using T = typename std::iterator_traits<Iter>::value_type;
+    parallelFor(pool,last - first,parallelBlockSize<T>(),[&](size_t begin,size_t end) {
+        for(size_t i = begin;i < end;i++) {
+            func(first[i]);
+        }
+    });
+}
+
+//reduce需要满足结合律，各数据块的部分结果按顺序合并
+template<typename Iter,typename T,typename Reduce,typename Transform>
+T parallelTransformReduce(ThreadPool& pool,Iter first,Iter last,T init,Reduce reduce,Transform transform) {
+    using V = typename std::iterator_traits<Iter>::value_type;
+    size_t n = last - first;
+    size_t grain = parallelBlockSize<V>();
+    size_t blocks = (n + grain - 1) / grain;
+    if(blocks <= 1) {
+        for(size_t i = 0;i < n;i++) {
+            init = reduce(init,transform(first[i]));
+        }
+        return init;
+    }
+    std::vector<T> partials(blocks);
+    parallelForBlocks(pool,blocks,[&](size_t block) {
+        size_t begin = block * grain;
+        size_t end = std::min(begin + grain,n);
+        //部分结果放在局部变量里面累加，避免不同线程写相邻的缓存行
+        T acc = transform(first[begin]);
+        for(size_t i = begin + 1;i < end;i++) {
+            acc = reduce(acc,transform(first[i]));
+        }
+        partials[block] = acc;
+    });
+    for(size_t i = 0;i < blocks;i++) {
+        init = reduce(init,partials[i]);
+    }
+    return init;
+}
+
+template<typename Iter,typename T>
+T parallelReduce(ThreadPool& pool,Iter first,Iter last,T init) {
+    return parallelTransformReduce(pool,first,last,init,std::plus<T>(),[](const T& x) -> T {return x;});
+}
+
+//三趟扫描：各块求和，块的和做前缀扫描得到每块的起始值，各块带着起始值扫描写出
+//out可以等于first(原地扫描)，op需要满足结合律
+template<typename Iter,typename OutIter,typename T,typename Op>
+OutIter scanImpl(ThreadPool& pool,Iter first,Iter last,OutIter out,bool hasInit,T init,Op op,bool inclusive) {
+    size_t n = last - first;
+    size_t grain = parallelBlockSize<T>();
+    //并行版本要读两遍输入，只有一个线程时直接串行扫描
+    size_t blocks = parallelWorkers(pool) > 1 ? (n + grain - 1) / grain : 1;
+    //scanBlock: 带着起始值扫描[begin,end)，hasAcc为false表示没有起始值(第一个块的inclusive scan)
+    auto scanBlock = [&](size_t begin,size_t end,bool hasAcc,T acc) {
+        size_t i = begin;
+        if(!hasAcc && i < end) {
+            acc = first[i];
+            out[i] = acc;
+            i++;
+        }
+        if(inclusive) {
+            for(;i < end;i++) {
+                acc = op(acc,first[i]);
+                out[i] = acc;
+            }
+        }
+        else {
+            for(;i < end;i++) {
+                T x = first[i];
+                out[i] = acc;
+                acc = op(acc,x);
+            }
+        }
+    };
+    if(blocks <= 1) {
+        scanBlock(0,n,hasInit,init);
+        return out + n;
+    }
+    std::vector<T> sums(blocks);
+    parallelForBlocks(pool,blocks - 1,[&](size_t block) {
+        size_t begin = block * grain;
+        size_t end = begin + grain;
+        T acc = first[begin];
+        for(size_t i = begin + 1;i < end;i++) {
+            acc = op(acc,first[i]);
+        }
+        sums[block] = acc;
+    });
+    //sums[i]变成第i块的起始值
+    bool hasAcc = hasInit;
+    T acc = init;
+    for(size_t i = 0;i < blocks;i++) {
+        T sum = sums[i];
+        sums[i] = acc;
+        acc = hasAcc ? op(acc,sum) : sum;
+        hasAcc = true;
+    }
+    parallelForBlocks(pool,blocks,[&](size_t block) {
+        size_t begin = block * grain;
+        scanBlock(begin,std::min(begin + grain,n),block > 0 || hasInit,sums[block]);
+    });
+    return out + n;
+}
+
+template<typename Iter,typename OutIter,typename Op = std::plus<typename std::iterator_traits<Iter>::value_type>>
+OutIter parallelInclusiveScan(ThreadPool& pool,Iter first,Iter last,OutIter out,Op op = Op()) {
+    using T = typename std::iterator_traits<Iter>::value_type;
+    return scanImpl(pool,first,last,out,false,T(),op,true);
+}
+
+template<typename Iter,typename OutIter,typename T,typename Op = std::plus<T>>
+OutIter parallelExclusiveScan(ThreadPool& pool,Iter first,Iter last,OutIter out,T init,Op op = Op()) {
+    return scanImpl(pool,first,last,out,true,init,op,false);
+}
+
+//先统计每块满足条件的个数，前缀和得到每块的输出位置，再并行写出，结果顺序和std::copy_if一致
+//pred对每个元素调用两次，不能有副作用
+template<typename Iter,typename OutIter,typename Pred>
+OutIter parallelCopyIf(ThreadPool& pool,Iter first,Iter last,OutIter out,Pred pred) {
+    using T = typename std::iterator_traits<Iter>::value_type;
+    size_t n = last - first;
+    size_t grain = parallelBlockSize<T>();
+    size_t blocks = parallelWorkers(pool) > 1 ? (n + grain - 1) / grain : 1;
+    if(blocks <= 1) {
+        return std::copy_if(first,last,out,pred);
+    }
+    std::vector<size_t> offsets(blocks + 1,0);
+    parallelForBlocks(pool,blocks,[&](size_t block) {
+        size_t begin = block * grain;
+        size_t end = std::min(begin + grain,n);
+        size_t count = 0;
+        for(size_t i = begin;i < end;i++) {
+            count += pred(first[i]) ? 1 : 0; //没有分支的计数循环
+        }
+        offsets[block + 1] = count;
+    });
+    std::partial_sum(offsets.begin(),offsets.end(),offsets.begin());
+    parallelForBlocks(pool,blocks,[&](size_t block) {
+        size_t begin = block * grain;
+        size_t end = std::min(begin + grain,n);
+        OutIter dst = out + offsets[block];
+        for(size_t i = begin;i < end;i++) {
+            if(pred(first[i])) {
+                *dst++ = first[i];
+            }
+        }
+    });
+    return out + offsets[blocks];
+}
+
+//在两个有序序列a、b的归并结果中，前k个元素里面有多少个来自a，相等的元素a在前
+template<typename Iter,typename Compare>
+size_t mergeSplit(Iter a,size_t m,Iter b,size_t l,size_t k,Compare& comp) {
+    size_t lo = k > l ? k - l : 0;
+    size_t hi = std::min(k,m);
+    while(lo < hi) {
+        size_t i = (lo + hi) / 2;
+        size_t j = k - i;
+        if(j > 0 && !comp(b[j - 1],a[i])) {
+            lo = i + 1;
+        }
+        else {
+            hi = i;
+        }
+    }
+    return lo;
+}
+
+//并行归并排序：数据分成2的幂个段，各段并行std::sort，之后逐轮两两归并
+//每轮的归并按输出位置切成数据块，用二分查找确定每块在两个输入段里面的起点，最后一轮也能并行
+//需要和输入等长的临时缓冲区，元素类型需要可以默认构造，结果不保证稳定
+template<typename Iter,typename Compare = std::less<typename std::iterator_traits<Iter>::value_type>>
+void parallelSort(ThreadPool& pool,Iter first,Iter last,Compare comp = Compare()) {
+    using T = typename std::iterator_traits<Iter>::value_type;
+    size_t n = last - first;
+    //只有一个线程时归并只会增加开销
+    size_t maxRuns = parallelWorkers(pool) > 1 ? 4 * parallelWorkers(pool) : 1;
+    size_t runs = 1;
+    while(runs * 2 <= maxRuns && n / (runs * 2) >= PARALLEL_SORT_MIN_RUN) {
+        runs *= 2;
+    }
+    if(runs == 1) {
+        std::sort(first,last,comp);
+        return;
+    }
+    auto bound = [&](size_t i) -> size_t {return n * i / runs;};
+    parallelForBlocks(pool,runs,[&](size_t run) {
+        std::sort(first + bound(run),first + bound(run + 1),comp);
+    });
+
+    std::vector<T> buffer(n);
+    size_t grain = parallelBlockSize<T>();
+    //src/dst在原数组和缓冲区之间交替
+    auto mergeRound = [&](auto src,auto dst,size_t width) {
+        size_t pairs = runs / (2 * width);
+        size_t maxPair = bound(2 * width) + 1; //各对长度最多差1
+        size_t piecesPerPair = (maxPair + grain - 1) / grain;
+        parallelForBlocks(pool,pairs * piecesPerPair,[&](size_t piece) {
+            size_t pair = piece / piecesPerPair;
+            size_t lo = bound(pair * 2 * width);
+            size_t mid = bound(pair * 2 * width + width);
+            size_t hi = bound(pair * 2 * width + 2 * width);
+            size_t k0 = std::min(lo + piece % piecesPerPair * grain,hi);
+            size_t k1 = std::min(k0 + grain,hi);
+            if(k0 == k1) {
+                return;
+            }
+            size_t m = mid - lo;
+            size_t l = hi - mid;
+            size_t i0 = mergeSplit(src + lo,m,src + mid,l,k0 - lo,comp);
+            size_t i1 = mergeSplit(src + lo,m,src + mid,l,k1 - lo,comp);
+            size_t j0 = k0 - lo - i0;
+            size_t j1 = k1 - lo - i1;
+            std::merge(std::make_move_iterator(src + lo + i0),std::make_move_iterator(src + lo + i1),
+                       std::make_move_iterator(src + mid + j0),std::make_move_iterator(src + mid + j1),
+                       dst + k0,comp);
+        });
+    };
+    bool inBuffer = false;
+    for(size_t width = 1;width < runs;width *= 2) {
+        if(inBuffer) {
+            mergeRound(buffer.begin(),first,width);
+        }
+        else {
+            mergeRound(first,buffer.begin(),width);
+        }
+        inBuffer = !inBuffer;
+    }
+    if(inBuffer) {
+        parallelFor(pool,n,grain,[&](size_t begin,size_t end) {
+            std::move(buffer.begin() + begin,buffer.begin() + end,first + begin);
+        });
+    }
+}
+
+#endif
@@ -11,10 +11,39 @@
 #include <thread>
 #include <unordered_map>
 #include <future>
+#include <deque>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <system_error>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <string>
+#include <new>
+#include <cstdio>
+#include <cstdint>
+#include <climits>
 
 const int TASK_MAX_THRESHHOLD = 2;
 const int THREAD_MAX_THRESHHOLD = 100;
 const int THREAD_MAX_IDLE_TIME = 60; // 单位：秒
+const int EPOLL_MAX_EVENTS = 64; // 一次epoll_wait最多取出的就绪事件数量
+const size_t STACK_CACHE_MAX_SIZE = 128; // 线程栈缓存最多保存的栈数量
+const int TASK_SUBMIT_TIMEOUT = 1000; // 任务队列满时提交任务最长的阻塞时间，单位：毫秒
+const int GLOBAL_TASK_MAX_THRESHHOLD = 1024; // 全局线程池的任务队列上限阈值
+const size_t RECORDER_BUFFER_SIZE = 4096; // 录制器缓冲的记录条数，满了写一次文件
+const size_t TASK_BYTES_AUTO = (size_t)-1; // 任务字节数由taskPayloadSize按参数估算
+
+//打开THREADPOOL_DEBUG后输出每个任务的调度日志，日志本身比小任务的开销大得多，默认关闭
+#ifdef THREADPOOL_DEBUG
+#define THREADPOOL_LOG(msg) std::cout << msg << std::endl
+#else
+#define THREADPOOL_LOG(msg)
+#endif
 
 //线程池支持的模式
 enum class PoolMode {
@@ -22,6 +51,134 @@ enum class PoolMode {
     MODE_CACHED, //线程数量可动态增长
 };
 
+//任务队列的调度方式
+enum class QueueMode {
+    QUEUE_FIFO, //按提交顺序执行
+    QUEUE_EDF,  //截止时间最早的任务优先执行(Earliest Deadline First)
+};
+
+//任务在截止时间之前没有开始执行，会被线程池丢弃，对应的future抛出这个异常
+class TaskTimeoutError : public std::runtime_error {
+public:
+    TaskTimeoutError():std::runtime_error("task deadline expired before it started") {}
+};
+
+//估算任务参数占用的内存，用于按字节数限制任务队列，默认是对象本身的大小
+//容器还要加上堆上的元素，自定义类型可以重载这个函数
+template<typename T>
+size_t taskPayloadSize(const T&) {
+    return sizeof(std::decay_t<T>); //函数类型退化成函数指针
+}
+
+inline size_t taskPayloadSize(const std::string& str) {
+    return sizeof(str) + str.capacity();
+}
+
+template<typename T,typename Alloc>
+size_t taskPayloadSize(const std::vector<T,Alloc>& vec) {
+    return sizeof(vec) + vec.capacity() * sizeof(T);
+}
+
+//任务组的统计信息
+struct GroupStats {
+    std::string name;
+    size_t queued;                //排队中的任务数量
+    int running;                  //正在执行的任务数量
+    unsigned long long submitted; //提交的任务总数
+    unsigned long long completed; //执行完的任务总数
+    double avgWaitUs;             //任务从提交到开始执行的平均等待时间，单位：微秒
+    double maxWaitUs;             //最长等待时间，单位：微秒
+};
+
+//提交任务的选项，默认值和submitTask一样
+struct TaskOptions {
+    int group = 0;                  //任务组，由createGroup返回
+    size_t bytes = TASK_BYTES_AUTO; //任务占用的内存字节数
+    //截止时间，max表示没有截止时间
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
+//线程属性
+struct ThreadAttr {
+    size_t stackSize = 0;    //线程栈大小，0表示使用系统默认的栈(通常是8MB)
+    size_t guardSize = 4096; //栈底的保护页大小，栈溢出时触发段错误而不是踩坏其他内存
+    std::string name;        //线程名前缀，实际的线程名是name + 线程id，最多15个字符
+};
+
+//线程栈缓存 
+//cached模式下线程会被频繁地回收和创建，回收线程的栈放到缓存里面，新线程直接复用，不用每次都mmap/munmap
+class StackCache {
+public:
+    static StackCache& instance() {
+        static StackCache cache;
+        return cache;
+    }
+
+    //fork前加锁，保证子进程里面的缓存是一致的，fork之后在父子进程里面分别解锁
+    void lockForFork() {
+        mtx_.lock();
+    }
+
+    void unlockForFork() {
+        mtx_.unlock();
+    }
+
+    ~StackCache() {
+        for(auto& stack : stacks_) {
+            ::munmap(stack.base,stack.stackSize + stack.guardSize);
+        }
+    }
+
+    //分配一个栈，返回整块内存的起始地址，前guardSize字节是保护页
+    void* allocate(size_t stackSize,size_t guardSize) {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            for(size_t i = stacks_.size();i > 0;i--) {
+                Stack& stack = stacks_[i - 1];
+                if(stack.stackSize == stackSize && stack.guardSize == guardSize) {
+                    void* base = stack.base;
+                    stacks_.erase(stacks_.begin() + (i - 1));
+                    return base;
+                }
+            }
+        }
+        void* base = ::mmap(nullptr,stackSize + guardSize,PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,-1,0);
+        if(base == MAP_FAILED) {
+            throw std::system_error(errno,std::generic_category(),"mmap thread stack");
+        }
+        if(guardSize > 0) {
+            ::mprotect(base,guardSize,PROT_NONE);
+        }
+        return base;
+    }
+
+    //归还一个栈，缓存满了直接释放
+    void deallocate(void* base,size_t stackSize,size_t guardSize) {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if(stacks_.size() < STACK_CACHE_MAX_SIZE) {
+                stacks_.push_back({base,stackSize,guardSize});
+                return;
+            }
+        }
+        ::munmap(base,stackSize + guardSize);
+    }
+
+    StackCache(const StackCache&) = delete;
+    StackCache& operator=(const StackCache&) = delete;
+private:
+    StackCache() = default;
+
+    struct Stack {
+        void* base;
+        size_t stackSize;
+        size_t guardSize;
+    };
+    std::mutex mtx_;
+    std::vector<Stack> stacks_;
+};
+
 //线程类型
 class Thread {
 public:
@@ -29,16 +186,54 @@ public:
     using ThreadFunc = std::function<void(int)>;//用来接受函数对象
 
     //线程构造
-    Thread(ThreadFunc func):func_(func),threadId_(generateId_++){}
+    Thread(ThreadFunc func,const ThreadAttr& attr = ThreadAttr())
+        :func_(func),attr_(attr),joinable_(false),stack_(nullptr),threadId_(generateId_++){}
 
-    //线程析构
-    ~Thread() = default;
+    //线程析构 线程还在运行的话等待它结束，再把栈还给缓存
+    ~Thread() {
+        join();
+    }
 
     //启动线程
     void start() {
-        //创建一个线程来执行一个线程函数
-        std::thread t(func_,threadId_);// C++11来说，有线程对象t和线程函数func_
-        t.detach();//设置分离对象
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if(attr_.stackSize > 0) {
+            //自己分配栈时pthread不会再加保护页，保护页由StackCache负责
+            stack_ = StackCache::instance().allocate(attr_.stackSize,attr_.guardSize);
+            int ret = pthread_attr_setstack(&attr,static_cast<char*>(stack_) + attr_.guardSize,attr_.stackSize);
+            if(ret != 0) {
+                //栈不可用时不能悄悄退回默认的栈，分配的栈也不能放进缓存
+                pthread_attr_destroy(&attr);
+                ::munmap(stack_,attr_.stackSize + attr_.guardSize);
+                stack_ = nullptr;
+                throw std::system_error(ret,std::generic_category(),"pthread_attr_setstack");
+            }
+        }
+        else {
+            pthread_attr_setguardsize(&attr,attr_.guardSize);
+        }
+        int ret = pthread_create(&handle_,&attr,&Thread::threadEntry,this);
+        pthread_attr_destroy(&attr);
+        if(ret != 0) {
+            releaseStack();
+            throw std::system_error(ret,std::generic_category(),"pthread_create");
+        }
+        joinable_ = true;
+    }
+
+    //fork之后子进程里面线程已经不存在了，不能再join，只回收栈
+    void abandon() {
+        joinable_ = false;
+    }
+
+    //等待线程结束 不能在线程自己里面调用
+    void join() {
+        if(joinable_) {
+            pthread_join(handle_,nullptr);
+            joinable_ = false;
+        }
+        releaseStack();
     }
 
     //获取线程id
@@ -46,13 +241,377 @@ public:
         return threadId_;
     }
 
+    Thread(const Thread&) = delete;
+    Thread& operator=(const Thread&) = delete;
+private:
+    static void* threadEntry(void* arg) {
+        Thread* self = static_cast<Thread*>(arg);
+        if(!self -> attr_.name.empty()) {
+            std::string name = (self -> attr_.name + std::to_string(self -> threadId_)).substr(0,15);
+            pthread_setname_np(pthread_self(),name.c_str());
+        }
+        self -> func_(self -> threadId_);
+        return nullptr;
+    }
+
+    void releaseStack() {
+        if(stack_ != nullptr) {
+            StackCache::instance().deallocate(stack_,attr_.stackSize,attr_.guardSize);
+            stack_ = nullptr;
+        }
+    }
 private:
     ThreadFunc func_;
-    static int generateId_;
+    ThreadAttr attr_;
+    pthread_t handle_;
+    bool joinable_;
+    void* stack_; //自己分配的线程栈，nullptr表示使用系统分配的栈
+    inline static int generateId_ = 0;
     int threadId_; //保存线程id
 };
+//进程内多个线程池共享的线程预算
+//注册到同一个ResourceManager的线程池，工作线程执行任务前要先拿到一个令牌，所有线程池同时执行任务的线程数不超过capacity
+//令牌只在执行任务期间持有，空闲线程池的额度自动借给繁忙的线程池
+//每个线程池可以预留一部分令牌(reserved)，令牌释放时优先给没有用满预留额度的线程池
+class ResourceManager {
+public:
+    //进程全局的ResourceManager，容量是CPU核数
+    //故意不析构，静态的线程池析构时可能还要访问它
+    static ResourceManager& instance() {
+        static ResourceManager* manager = new ResourceManager(std::thread::hardware_concurrency());
+        return *manager;
+    }
+
+    explicit ResourceManager(int capacity):capacity_(std::max(capacity,1)),inUse_(0),reservedSize_(0) {}
+
+    //设置令牌总数
+    void setCapacity(int capacity) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        capacity_ = std::max(capacity,1);
+        cond_.notify_all();
+    }
+
+    int getCapacity() {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return capacity_;
+    }
+
+    //正在使用的令牌数量
+    int getInUse() {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return inUse_;
+    }
+
+    //注册一个线程池，返回线程池在ResourceManager中的id
+    int registerPool(int reserved) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        pools_.push_back({std::max(reserved,0),0,0,0,true});
+        reservedSize_ += std::max(reserved,0);
+        return (int)pools_.size() - 1;
+    }
+
+    void unregisterPool(int poolId) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        reservedSize_ -= pools_[poolId].reserved;
+        pools_[poolId] = {0,0,0,0,false};
+        cond_.notify_all();
+    }
+
+    //获取一个令牌，没有令牌的时候阻塞
+    //同一个线程重复调用只增加计数，不会重复占用额度
+    void acquire(int poolId) {
+        acquireImpl(poolId,false,0);
+    }
+
+    //和acquire一样，但是wakeWaiters(poolId)使唤醒序号不等于wakeSeq时放弃等待，返回false
+    //wakeSeq由getWakeSeq获取，获取之后的唤醒不会丢失
+    bool acquire(int poolId,unsigned long long wakeSeq) {
+        return acquireImpl(poolId,true,wakeSeq);
+    }
+
+    unsigned long long getWakeSeq(int poolId) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return pools_[poolId].wakeSeq;
+    }
+
+    //让线程池里面等待令牌的线程放弃等待，去执行借用令牌的任务
+    void wakeWaiters(int poolId) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        pools_[poolId].wakeSeq++;
+        cond_.notify_all();
+    }
+
+    //当前线程是否持有manager的令牌(包括借用的令牌)
+    static bool holdsLease(const ResourceManager* manager) {
+        return manager != nullptr && lease_.manager == manager;
+    }
+
+    //借用令牌执行任务：任务的提交者持有同一个ResourceManager的令牌，通常在等待这个任务的结果
+    //借用的令牌不占用额度，用release结束借用
+    void borrow(int poolId) {
+        lease_ = {this,poolId,1,true};
+    }
+
+    //归还令牌
+    void release() {
+        if(--lease_.depth > 0) {
+            return;
+        }
+        bool isBorrowed = lease_.isBorrowed;
+        int poolId = lease_.poolId;
+        lease_ = {nullptr,-1,0,false};
+        if(isBorrowed) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mtx_);
+        pools_[poolId].inUse--;
+        inUse_--;
+        //没有预留额度时所有等待者的条件都一样，唤醒一个就够了，避免惊群
+        if(reservedSize_ == 0) {
+            cond_.notify_one();
+        }
+        else {
+            cond_.notify_all();
+        }
+    }
+
+    //线程池的工作线程在执行任务期间一直持有令牌，ResourceManager不知道任务在等待什么
+    //持有令牌的任务提交给同一个ResourceManager下另一个线程池的任务会借用提交者的令牌执行，直接future.get()等待也不会死锁
+    //BlockingScope(或者waitFor)在阻塞期间临时归还令牌，让其他任务用这个额度执行，比如等待外部事件的时候
+    //不在线程池的工作线程里面使用，或者当前的令牌是借用的时候，什么也不做
+    class BlockingScope {
+    public:
+        BlockingScope()
+            :manager_(lease_.isBorrowed ? nullptr : lease_.manager),poolId_(lease_.poolId),depth_(lease_.depth) {
+            if(manager_ != nullptr) {
+                lease_.depth = 1;
+                manager_ -> release();
+            }
+        }
+        ~BlockingScope() {
+            if(manager_ != nullptr) {
+                manager_ -> acquire(poolId_);
+                lease_.depth = depth_;
+            }
+        }
+        BlockingScope(const BlockingScope&) = delete;
+        BlockingScope& operator=(const BlockingScope&) = delete;
+    private:
+        ResourceManager* manager_;
+        int poolId_;
+        int depth_;
+    };
+
+    //在任务里面等待另一个线程池的结果，等待期间归还令牌
+    template<typename T>
+    static T waitFor(std::future<T>& future) {
+        BlockingScope scope;
+        return future.get();
+    }
+
+    ResourceManager(const ResourceManager&) = delete;
+    ResourceManager& operator=(const ResourceManager&) = delete;
+private:
+    struct Lease {
+        int reserved; //预留的令牌数量
+        int inUse;    //正在使用的令牌数量
+        int waiting;  //等待令牌的线程数量
+        unsigned long long wakeSeq; //wakeWaiters的次数
+        bool isRegistered;
+    };
+
+    //当前线程持有的令牌
+    struct ThreadLease {
+        ResourceManager* manager;
+        int poolId;
+        int depth;
+        bool isBorrowed; //借用提交者的令牌，不占用额度
+    };
+
+    //interruptible为true时，唤醒序号变化后放弃等待返回false
+    bool acquireImpl(int poolId,bool interruptible,unsigned long long wakeSeq) {
+        if(lease_.manager != nullptr) {
+            lease_.depth++;
+            return true;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            //pools_可能在等待期间扩容，不能保存元素的引用
+            pools_[poolId].waiting++;
+            cond_.wait(lock,[&]() -> bool {
+                return canAcquire(poolId) || (interruptible && pools_[poolId].wakeSeq != wakeSeq);
+            });
+            pools_[poolId].waiting--;
+            if(!canAcquire(poolId)) {
+                return false;
+            }
+            pools_[poolId].inUse++;
+            inUse_++;
+        }
+        lease_ = {this,poolId,1,false};
+        return true;
+    }
+
+    //没用满预留额度的线程池可以拿任何空闲令牌，其他线程池要给正在等待的预留额度留出令牌
+    bool canAcquire(int poolId) const {
+        int free = capacity_ - inUse_;
+        if(free <= 0) {
+            return false;
+        }
+        const Lease& self = pools_[poolId];
+        if(self.inUse < self.reserved) {
+            return true;
+        }
+        int owed = 0;
+        for(size_t i = 0;i < pools_.size();i++) {
+            const Lease& pool = pools_[i];
+            if((int)i != poolId && pool.waiting > 0 && pool.inUse < pool.reserved) {
+                owed += std::min(pool.waiting,pool.reserved - pool.inUse);
+            }
+        }
+        return free > owed;
+    }
+private:
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    int capacity_; //令牌总数
+    int inUse_;    //正在使用的令牌数量
+    int reservedSize_; //所有线程池预留的令牌总数
+    std::vector<Lease> pools_;
+    inline static thread_local ThreadLease lease_ = {nullptr,-1,0,false};
+};
+
+//录制文件里面的一条记录，每个用户提交的任务执行完、被丢弃或者提交失败时写一条，时间相对于录制开始
+struct WorkloadRecord {
+    static constexpr uint32_t REJECTED = 1; //任务队列满，提交失败
+    static constexpr uint32_t EXPIRED = 2;  //超过截止时间被丢弃，没有执行
+
+    uint64_t submitNs;   //调用submitTask的时间，在等待任务队列空余之前
+    uint64_t runNs;      //执行时间，被拒绝或者超时丢弃的任务为0
+    uint32_t blockUs;    //提交时等待任务队列空余的时间，单位：微秒
+    uint32_t thread;     //提交任务的线程编号
+    uint32_t queueDepth; //提交时任务队列中的任务数量
+    uint32_t flags;      //REJECTED、EXPIRED，正常执行的任务为0
+};
+
+/*
+负载录制器：
+把用户提交的任务的到达时间、提交阻塞时间、提交线程、队列深度和执行时间写到二进制文件，replayworkload按同样的到达模式重放
+线程池内部的任务(定时器、I/O回调、execute)不录制
+文件格式：8字节文件头("TPWL"和版本号)，之后是连续的WorkloadRecord(每条32字节)，按完成顺序排列
+example:
+WorkloadRecorder recorder("pool.trace");
+ThreadPool pool;
+pool.setRecorder(recorder); //recorder的生命周期要比pool长
+pool.start(4);
+*/
+class WorkloadRecorder {
+public:
+    explicit WorkloadRecorder(const std::string& path)
+        :file_(std::fopen(path.c_str(),"wb")),origin_(std::chrono::steady_clock::now()),recordSize_(0) {
+        if(file_ == nullptr) {
+            std::cerr << "open workload record file " << path << " fail." << std::endl;
+            return;
+        }
+        uint32_t header[2] = {MAGIC,VERSION};
+        std::fwrite(header,sizeof(header),1,file_);
+        buffer_.reserve(RECORDER_BUFFER_SIZE);
+    }
+
+    ~WorkloadRecorder() {
+        close();
+    }
+
+    bool isOpen() const {
+        return file_ != nullptr;
+    }
+
+    //写出缓冲的记录并关闭文件，之后的记录被忽略
+    void close() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if(file_ == nullptr) {
+            return;
+        }
+        writeBuffer();
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+
+    //已经记录的任务数量
+    size_t getRecordSize() const {
+        return recordSize_;
+    }
+
+    void record(std::chrono::steady_clock::time_point submit,std::chrono::steady_clock::duration block,
+                uint32_t thread,uint32_t queueDepth,std::chrono::steady_clock::duration run,uint32_t flags) {
+        WorkloadRecord r;
+        r.submitNs = std::chrono::duration_cast<std::chrono::nanoseconds>(submit - origin_).count();
+        r.runNs = std::chrono::duration_cast<std::chrono::nanoseconds>(run).count();
+        r.blockUs = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(block).count();
+        r.thread = thread;
+        r.queueDepth = queueDepth;
+        r.flags = flags;
+        std::lock_guard<std::mutex> lock(mtx_);
+        if(file_ == nullptr) {
+            return;
+        }
+        buffer_.push_back(r);
+        recordSize_++;
+        if(buffer_.size() == RECORDER_BUFFER_SIZE) {
+            writeBuffer();
+        }
+    }
+
+    //当前线程的编号，从0开始，比thread::id紧凑
+    static uint32_t threadIndex() {
+        static std::atomic<uint32_t> nextIndex(0);
+        thread_local uint32_t index = nextIndex++;
+        return index;
+    }
+
+    //读取录制文件，按提交时间排序，文件格式不对返回空
+    static std::vector<WorkloadRecord> load(const std::string& path) {
+        std::vector<WorkloadRecord> records;
+        FILE* file = std::fopen(path.c_str(),"rb");
+        if(file == nullptr) {
+            std::cerr << "open workload record file " << path << " fail." << std::endl;
+            return records;
+        }
+        uint32_t header[2];
+        if(std::fread(header,sizeof(header),1,file) != 1 || header[0] != MAGIC || header[1] != VERSION) {
+            std::cerr << path << " is not a workload record file." << std::endl;
+            std::fclose(file);
+            return records;
+        }
+        WorkloadRecord r;
+        while(std::fread(&r,sizeof(r),1,file) == 1) {
+            records.push_back(r);
+        }
+        std::fclose(file);
+        std::stable_sort(records.begin(),records.end(),[](const WorkloadRecord& a,const WorkloadRecord& b) {
+            return a.submitNs < b.submitNs;
+        });
+        return records;
+    }
+
+    WorkloadRecorder(const WorkloadRecorder&) = delete;
+    WorkloadRecorder& operator=(const WorkloadRecorder&) = delete;
+private:
+    //调用时持有mtx_
+    void writeBuffer() {
+        std::fwrite(buffer_.data(),sizeof(WorkloadRecord),buffer_.size(),file_);
+        buffer_.clear();
+    }
+private:
+    static const uint32_t MAGIC = 0x4C575054; // "TPWL"
+    static const uint32_t VERSION = 2;
+    std::mutex mtx_;
+    FILE* file_;
+    std::chrono::steady_clock::time_point origin_; //录制开始的时间
+    std::vector<WorkloadRecord> buffer_;
+    std::atomic<size_t> recordSize_;
+};
 
-int Thread::generateId_ = 0;
 /*
 example:
 ThreadPool pool;
@@ -69,16 +628,44 @@ pool.submitTask(std::make_shared<MyTask>());
 //线程池类型
 class ThreadPool{
 public:
+    //截止时间使用的时钟，不受系统时间调整的影响
+    using Clock = std::chrono::steady_clock;
+
     //线程池构造
-    ThreadPool():initThreadSize_(4),
+    ThreadPool():threadMaxIdleTime_(THREAD_MAX_IDLE_TIME),
+                 resourceManager_(nullptr),
+                 resourcePoolId_(-1),
+                 tokenWaitSize_(0),
+                 recorder_(nullptr),
+                 initThreadSize_(4),
+                 curThreadSize_(0),
+                 idleThreadSize_(0),
+                 threadSizeThresdHold_(THREAD_MAX_THRESHHOLD),
+                 queueMode_(QueueMode::QUEUE_FIFO),
                  taskSize_(0),
                  taskQueMaxThreshHold_(TASK_MAX_THRESHHOLD),
-                 threadSizeThresdHold_(THREAD_MAX_THRESHHOLD),
-                 curThreadSize_(0),
+                 taskSeq_(0),
+                 expiredTaskSize_(0),
+                 failedCallbackSize_(0),
+                 taskQueMaxBytes_(0),
+                 queuedBytes_(0),
+                 inFlightBytes_(0),
+                 submitTimeout_(TASK_SUBMIT_TIMEOUT),
+                 needRespawn_(false),
+                 epollFd_(-1),
+                 wakeFd_(-1),
+                 ioWatchSeq_(0),
+                 isPolling_(false),
+                 condWaitSize_(0),
+                 notifySeq_(0),
+                 timerSeq_(0),
+                 nextDeadline_(Clock::time_point::max()),
                  poolMode_(PoolMode::MODE_FIXED),
-                 isPoolRunning_(false),
-                 idleThreadSize_(0)
-                {}
+                 isPoolRunning_(false)
+                {
+                    //0号是默认任务组，submitTask提交的任务都在这个组里面
+                    groups_.emplace_back(std::make_unique<TaskGroup>("default",1,0,queueMode_));
+                }
 
     //线程池析构
     ~ThreadPool(){
@@ -87,8 +674,30 @@ public:
 
         //等待线程池里面所有的线程返回 有两种状态：阻塞 正在执行任务中,第三情况：可能发生死锁，线程刚进入循环处于拿锁状态
         std::unique_lock<std::mutex> lock(taskQueMtx_);
-        notEmpty_.notify_all(); //避免死锁，比如线程池线程先拿到锁进入的等待的时候，还有机会去唤醒。
+        notifyNotEmpty(); //避免死锁，比如线程池线程先拿到锁进入的等待的时候，还有机会去唤醒。
+        wakePoller(); //阻塞在epoll_wait上的线程也要唤醒
         exitCond_.wait(lock,[&]() -> bool{return threads_.size() == 0;});//主线程(用户线程阻塞在这里等待线程池中的线程回收)
+        joinExitedThreads();
+        //清理过期任务的线程要拿到锁才能退出，先释放锁再join
+        deadlineCond_.notify_all();
+        lock.unlock();
+        deadlineThread_.reset();
+
+        if(epollFd_ >= 0) {
+            ::close(epollFd_);
+            ::close(wakeFd_);
+        }
+        if(resourceManager_ != nullptr) {
+            resourceManager_ -> unregisterPool(resourcePoolId_);
+        }
+    }
+
+    //进程全局的线程池，第一次调用时才创建和启动，不使用它的进程没有任何开销
+    //fork之后子进程里面的全局线程池自动重建：工作线程在第一次提交任务时重新创建
+    //fork时还在排队的任务在子进程里面被丢弃(future抛出broken_promise)，正在执行的任务只在父进程里面完成
+    static ThreadPool& global(){
+        static ThreadPool* pool = createGlobal();
+        return *pool;
     }
 
     //设置线程池的工作模式
@@ -107,6 +716,47 @@ public:
         taskQueMaxThreshHold_ = threshhold;
     }
 
+    //设置任务占用内存的上限阈值，排队中和执行中的任务的字节数之和不能超过它，0表示不限制
+    //任务的字节数由submitTaskSized声明，或者由taskPayloadSize按参数估算
+    void setTaskQueMaxBytes(size_t bytes){
+        if(checkRunningState()) {
+            return;
+        }
+        taskQueMaxBytes_ = bytes;
+    }
+
+    //设置任务队列满(任务数量或者字节数超过阈值)时提交任务的最长阻塞时间，0表示直接提交失败
+    void setTaskSubmitTimeout(std::chrono::milliseconds timeout){
+        if(checkRunningState()) {
+            return;
+        }
+        submitTimeout_ = (int)timeout.count();
+    }
+
+    //排队中的任务占用的字节数
+    size_t getQueuedBytes() const {
+        return queuedBytes_;
+    }
+
+    //正在执行的任务占用的字节数
+    size_t getInFlightBytes() const {
+        return inFlightBytes_;
+    }
+
+    //当前的线程数量
+    int getThreadSize() const {
+        return curThreadSize_;
+    }
+
+    //可以执行任务的线程数量，线程池没有启动时为0
+    //fork之后子进程的工作线程在第一次提交任务时才重新创建，这之前按初始线程数量计算
+    int getWorkerSize() const {
+        if(!isPoolRunning_) {
+            return 0;
+        }
+        return std::max(curThreadSize_.load(),(int)initThreadSize_);
+    }
+
     //设置线程数量上限阈值
     void setThreadSizeThreshHold(int threshhold){
         if(checkRunningState()) {
@@ -117,59 +767,213 @@ public:
         }
     }
 
+    //设置线程栈大小，0表示使用系统默认的栈
+    //不足PTHREAD_STACK_MIN时按PTHREAD_STACK_MIN分配，并向上取整到页大小
+    void setThreadStackSize(size_t stackSize){
+        if(checkRunningState()) {
+            return;
+        }
+        if(stackSize > 0) {
+            size_t page = (size_t)::sysconf(_SC_PAGESIZE);
+            stackSize = std::max(stackSize,(size_t)PTHREAD_STACK_MIN);
+            stackSize = (stackSize + page - 1) / page * page;
+        }
+        threadAttr_.stackSize = stackSize;
+    }
+
+    //设置线程栈保护页大小
+    void setThreadGuardSize(size_t guardSize){
+        if(checkRunningState()) {
+            return;
+        }
+        threadAttr_.guardSize = guardSize;
+    }
+
+    //设置线程名前缀，方便在top/gdb中区分不同线程池的线程
+    void setThreadName(const std::string& name){
+        if(checkRunningState()) {
+            return;
+        }
+        threadAttr_.name = name;
+    }
+
+    //设置cached模式下多余线程的最长空闲时间，单位：秒
+    void setThreadMaxIdleTime(int seconds){
+        if(checkRunningState()) {
+            return;
+        }
+        threadMaxIdleTime_ = seconds;
+    }
+
+    //加入多个线程池共享的线程预算，执行任务的线程数受manager的容量限制
+    //reserved: 为这个线程池预留的令牌数量，其他线程池只能借用超出预留部分的空闲令牌
+    void setResourceManager(ResourceManager& manager,int reserved = 0){
+        if(checkRunningState()) {
+            return;
+        }
+        if(resourceManager_ != nullptr) {
+            resourceManager_ -> unregisterPool(resourcePoolId_);
+        }
+        resourceManager_ = &manager;
+        resourcePoolId_ = manager.registerPool(reserved);
+    }
+
+    //录制每个任务的到达时间和执行时间，recorder的生命周期要比线程池长
+    void setRecorder(WorkloadRecorder& recorder){
+        if(checkRunningState()) {
+            return;
+        }
+        recorder_ = &recorder;
+    }
+
+    //设置任务队列的调度方式
+    void setQueueMode(QueueMode mode){
+        if(checkRunningState()) {
+            return;
+        }
+        queueMode_ = mode;
+        for(auto& group : groups_) {
+            group -> que.setMode(mode);
+        }
+    }
+
+    //监听fd上的I/O事件(EPOLLIN/EPOLLOUT...)，fd就绪后把callback当作一个任务交给线程池执行
+    //注册是一次性的，callback执行前就已经注销，需要继续监听可以在callback里面再次调用watchFd
+    //同一个fd重复注册会覆盖之前的callback，线程池没有启动时返回false
+    //callback抛出的异常被丢弃，计入getFailedCallbackSize
+    bool watchFd(int fd,uint32_t events,std::function<void(uint32_t)> callback){
+        return addWatch(fd,events,std::move(callback)) == 0;
+    }
+
+    //取消对fd的监听，关闭fd之前要先调用
+    //unwatchFd返回之后callback不会再开始执行，已经就绪、还在任务队列里面的callback也会被取消
+    //只有unwatchFd之前已经开始执行的callback不能取消，在callback里面关闭fd时不需要调用
+    void unwatchFd(int fd){
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        auto it = ioWatches_.find(fd);
+        if(it != ioWatches_.end()) {
+            //已经就绪的fd在epoll里面是禁用状态，也要删除，否则fd号被复用后再注册会失败
+            ::epoll_ctl(epollFd_,EPOLL_CTL_DEL,fd,nullptr);
+            ioWatches_.erase(it);
+        }
+    }
+
+    //等待fd就绪，返回的future得到就绪的事件
+    std::future<uint32_t> asyncWait(int fd,uint32_t events){
+        auto promise = std::make_shared<std::promise<uint32_t>>();
+        std::future<uint32_t> result = promise -> get_future();
+        int err = addWatch(fd,events,[promise](uint32_t revents) {promise -> set_value(revents);});
+        if(err != 0) {
+            promise -> set_exception(std::make_exception_ptr(
+                std::system_error(err,std::generic_category(),"watchFd")));
+        }
+        return result;
+    }
+
+    //提交一个没有返回值的任务，不受任务队列上限的限制，用于协程恢复这类不能丢弃的内部任务
+    //func抛出的异常被丢弃，计入getFailedCallbackSize
+    void execute(std::function<void()> func){
+        Task t;
+        t.func = std::move(func);
+        t.deadline = Clock::time_point::max();
+        enqueueTask(std::move(t),false);
+    }
+
+    //定时任务：到when时刻把func放入任务队列执行
+    //定时器由epoll_wait的超时时间驱动，所有线程都在执行任务时会推迟到有线程空闲或者取下一个任务时
+    //func抛出的异常被丢弃，计入getFailedCallbackSize
+    void runAt(Clock::time_point when,std::function<void()> func){
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        respawnAfterFork();
+        timers_.push_back({when,timerSeq_++,std::move(func)});
+        std::push_heap(timers_.begin(),timers_.end(),timerLater);
+        //新的定时器最早到期，epoll_wait的超时时间需要重新计算
+        if(isPolling_ && timers_.front().seq + 1 == timerSeq_) {
+            wakePoller();
+        }
+    }
+
+    //定时任务：delay之后执行func
+    void runAfter(Clock::duration delay,std::function<void()> func){
+        runAt(Clock::now() + delay,std::move(func));
+    }
+
+    //创建任务组，返回任务组id，可以在任何时候调用
+    //多个任务组之间按权重轮流调度(Deficit Round Robin)，一个组提交大量任务不会饿死其他组
+    //weight: 每一轮最多连续执行的任务数量 maxConcurrency: 组内最多同时执行的任务数量，0表示不限制
+    //任务队列上限阈值对每个任务组分别生效
+    int createGroup(const std::string& name,int weight = 1,int maxConcurrency = 0){
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        groups_.emplace_back(std::make_unique<TaskGroup>(name,std::max(weight,1),std::max(maxConcurrency,0),queueMode_));
+        return (int)groups_.size() - 1;
+    }
+
+    //获取任务组的统计信息
+    GroupStats getGroupStats(int groupId){
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        const TaskGroup& group = *groups_.at(groupId);
+        GroupStats stats;
+        stats.name = group.name;
+        stats.queued = group.que.size();
+        stats.running = group.running;
+        stats.submitted = group.submitted;
+        stats.completed = group.completed;
+        stats.avgWaitUs = group.started == 0 ? 0 :
+            std::chrono::duration<double,std::micro>(group.totalWait).count() / group.started;
+        stats.maxWaitUs = std::chrono::duration<double,std::micro>(group.maxWait).count();
+        return stats;
+    }
+
+    //获取因为超过截止时间而被丢弃的任务数量
+    unsigned int getExpiredTaskSize() const {
+        return expiredTaskSize_;
+    }
+
+    //获取抛出异常的回调数量(watchFd、runAt/runAfter、execute)，异常被丢弃，不会传给调用者
+    unsigned int getFailedCallbackSize() const {
+        return failedCallbackSize_;
+    }
+
     //给线程池提交任务
     //使用可变参模板编程，让submitTask可以接收任意任务函数和任意数量的参数
     //返回值需要一个future<>,推导出来返回值类型,然后实例化future
     template<typename Func,typename... Args>
     auto submitTask(Func&& func,Args&&... args) -> std::future<decltype(func(args...))> {
-        //打包任务放入任务队列
-        using RType = decltype(func(args...)); //推导出来的是类型
-        auto task = std::make_shared<std::packaged_task<RType()>>(
-            std::bind(std::forward<Func>(func),std::forward<Args>(args)...)); 
-        std::future<RType> result = task -> get_future();
-         //获取锁
-        std::unique_lock<std::mutex> lock(taskQueMtx_);
-        //线程通信 等待任务队列有空余
-        // while(taskQue_.size() == taskQueMaxThreshHold_) {
-        //     notFull_.wait(lock);
-        // }
-        //taskQue_队列满则阻塞，用户提交任务最长不能阻塞1s，否则判断提交任务失败，返回
-        // notFull_.wait(lock,[&]() -> bool {return taskQue_.size() < taskQueMaxThreshHold_;});
-        if(!notFull_.wait_for(lock,std::chrono::seconds(1),
-                        [&]() -> bool {return taskQue_.size() < (size_t) taskQueMaxThreshHold_;})) {
-            //表示notFull_等待1s中，条件依然没有满足。
-            std::cerr << "task queue is full, submit task fail." << std::endl;
-            auto task = std::make_shared<std::packaged_task<RType()>>(
-                []() -> RType {return RType();});
-            (*task)();//执行这个任务，不然不执行获取返回值会崩溃
-            return  task -> get_future();
-        }
-        //如果有空余，把任务放到任务队列中
-        // taskQue_.emplace(sp);  using Task = std::function<void()>;//不能确定返回值的类型
-        taskQue_.emplace([task]() {(*task)();}); //增加一个中间层返回值是void不带参数的一个lamda表达式将实际要执行的任务封装起来
+        return submitTaskWith(TaskOptions(),std::forward<Func>(func),std::forward<Args>(args)...);
+    }
 
-        taskSize_++;
-        //因为新放了任务，任务队列不为空，在notEmpty上进行通知，赶快分配线程执行任务
-        notEmpty_.notify_all();
+    //给线程池提交任务，并声明任务占用的内存字节数
+    template<typename Func,typename... Args>
+    auto submitTaskSized(size_t bytes,Func&& func,Args&&... args) -> std::future<decltype(func(args...))> {
+        TaskOptions options;
+        options.bytes = bytes;
+        return submitTaskWith(options,std::forward<Func>(func),std::forward<Args>(args)...);
+    }
 
-        //cached模式，任务处理比较紧急 场景：小而快的任务需要根据任务数量和空闲线程数量，判断是否需要新的线程出来
-        if(poolMode_ == PoolMode::MODE_CACHED 
-                && taskSize_ > idleThreadSize_
-                && curThreadSize_ < threadSizeThresdHold_) {
-            std::cout << ">>> create new thread ..." << std::endl;
-            //创建新线程
-            std::unique_ptr<Thread> ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc,this,std::placeholders::_1));
-            int threadId = ptr -> getId();
-            threads_.emplace(threadId,std::move(ptr));
-            //启动线程
-            threads_[threadId] -> start();
-            //修改线程个数相关数量
-            curThreadSize_++;
-            idleThreadSize_++;
-        }
+    //给线程池提交带截止时间的任务
+    //deadline之前任务还没有开始执行，任务会被丢弃，future.get()抛出TaskTimeoutError
+    template<typename Func,typename... Args>
+    auto submitTaskUntil(Clock::time_point deadline,Func&& func,Args&&... args) -> std::future<decltype(func(args...))> {
+        TaskOptions options;
+        options.deadline = deadline;
+        return submitTaskWith(options,std::forward<Func>(func),std::forward<Args>(args)...);
+    }
 
-        return result;
-        // return task -> getResult();
+    //给指定的任务组提交任务，groupId由createGroup返回，groupId无效时提交失败
+    template<typename Func,typename... Args>
+    auto submitTaskTo(int groupId,Func&& func,Args&&... args) -> std::future<decltype(func(args...))> {
+        TaskOptions options;
+        options.group = groupId;
+        return submitTaskWith(options,std::forward<Func>(func),std::forward<Args>(args)...);
+    }
+
+    //按选项提交任务，任务组、截止时间和字节数可以任意组合
+    template<typename Func,typename... Args>
+    auto submitTaskWith(const TaskOptions& options,Func&& func,Args&&... args) -> std::future<decltype(func(args...))> {
+        using RType = decltype(func(args...)); //推导出来的是类型
+        //参数转发之前估算占用的内存
+        size_t bytes = options.bytes == TASK_BYTES_AUTO ? estimateBytes(func,args...) : options.bytes;
+        return packTask<RType>(options,bytes,std::bind(std::forward<Func>(func),std::forward<Args>(args)...));
     }
 
     //开启线程池
@@ -181,9 +985,11 @@ public:
         initThreadSize_ = initThreadSize;
         curThreadSize_ = initThreadSize;
 
+        createReactor();
+
         //创建线程对象
         for(int i = 0;i < initThreadSize_;i++) {
-            std::unique_ptr<Thread> ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc,this,std::placeholders::_1));
+            std::unique_ptr<Thread> ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc,this,std::placeholders::_1),threadAttr_);
             //创建thread线程对象的时候，把线程函数给到thread线程对象
             //用于创建一个新的可调用对象，将ThreadPool 类的成员函数 threadFunc 和当前 ThreadPool 对象的实例（通过 this 指针）绑定在一起。
             //该对象用ThreadFunc接收，见Thread的构造函数。
@@ -192,9 +998,9 @@ public:
             threads_.emplace(std::make_pair(threadId,std::move(ptr)));
         }
 
-        //启动所有线程
-        for(int i = 0;i < initThreadSize_;i++) {
-            threads_[i] -> start();//需要去执行一个线程函数
+        //启动所有线程 线程id是全局递增的，不一定从0开始
+        for(auto& thread : threads_) {
+            thread.second -> start();//需要去执行一个线程函数
             idleThreadSize_++;//记录初始空闲现场的数量
         }
     }
@@ -202,79 +1008,908 @@ public:
     ThreadPool(const ThreadPool&) = delete;
     ThreadPool &operator = (const ThreadPool&) = delete;
 private:
+    //定时器
+    struct Timer {
+        Clock::time_point when;
+        unsigned long long seq;
+        std::function<void()> func;
+    };
+
+    //工作线程正在执行的任务，在任务里面fork时子进程要保留这个线程
+    struct WorkerContext {
+        ThreadPool* pool; //nullptr表示当前线程没有在执行线程池的任务
+        int threadId;
+        int group;
+        size_t bytes;
+    };
+
+    //fd的一次监听
+    struct IoWatch {
+        std::function<void(uint32_t)> callback;
+        unsigned long long seq; //注册序号，回调执行时核对，被取消或者重新注册后旧的回调不执行
+        bool isReady;           //已经就绪，回调在任务队列里面等待执行
+    };
+
+    //定时器小根堆，堆顶是最早到期的定时器
+    static bool timerLater(const Timer& a,const Timer& b) {
+        if(a.when != b.when) {
+            return a.when > b.when;
+        }
+        return a.seq > b.seq;
+    }
+
+    //线程池内部的任务对象
+    struct Task {
+        std::function<void()> func;   //实际要执行的任务
+        std::function<void()> expire; //截止时间已过还没有执行时调用，让future抛出TaskTimeoutError
+        Clock::time_point deadline;   //没有截止时间的任务为time_point::max()
+        unsigned long long seq = 0;   //提交序号，截止时间相同的任务按提交顺序执行
+        int group = 0;                //所属任务组
+        size_t bytes = 0;             //任务占用的内存字节数
+        Clock::time_point submitTime; //入队时间，用来统计排队等待时间
+        bool isRecorded = false;      //用户提交的任务才录制，线程池内部的定时器、I/O回调和execute不录制
+        bool isLent = false;          //提交者持有同一个ResourceManager的令牌，任务借用它的令牌执行
+        Clock::time_point arriveTime; //调用submitTask的时间，录制时使用
+        uint32_t submitThread = 0;    //提交任务的线程编号，录制时使用
+        uint32_t queueDepth = 0;      //提交时任务队列中的任务数量，录制时使用
+    };
+
+    //任务队列 FIFO模式下是一个双端队列，EDF模式下是按截止时间排序的小根堆
+    class TaskQueue {
+    public:
+        TaskQueue():mode_(QueueMode::QUEUE_FIFO),deadlineSize_(0) {}
+
+        void setMode(QueueMode mode) {
+            mode_ = mode;
+        }
+
+        size_t size() const {
+            return mode_ == QueueMode::QUEUE_FIFO ? fifo_.size() : heap_.size();
+        }
+
+        void push(Task task) {
+            if(task.deadline != Clock::time_point::max()) {
+                deadlineSize_++;
+            }
+            if(mode_ == QueueMode::QUEUE_FIFO) {
+                fifo_.emplace_back(std::move(task));
+            }
+            else {
+                heap_.emplace_back(std::move(task));
+                std::push_heap(heap_.begin(),heap_.end(),later);
+            }
+        }
+
+        //取出下一个要执行的任务
+        Task pop() {
+            Task task;
+            if(mode_ == QueueMode::QUEUE_FIFO) {
+                task = std::move(fifo_.front());
+                fifo_.pop_front();
+            }
+            else {
+                std::pop_heap(heap_.begin(),heap_.end(),later);
+                task = std::move(heap_.back());
+                heap_.pop_back();
+            }
+            if(task.deadline != Clock::time_point::max()) {
+                deadlineSize_--;
+            }
+            return task;
+        }
+
+        //取出所有截止时间已过的任务放到expired里面，返回取出的数量
+        //EDF模式下只需要看堆顶，FIFO模式下队列里面有带截止时间的任务时才扫描
+        size_t removeExpired(Clock::time_point now,std::vector<Task>& expired) {
+            size_t before = expired.size();
+            if(mode_ == QueueMode::QUEUE_EDF) {
+                while(!heap_.empty() && heap_.front().deadline < now) {
+                    std::pop_heap(heap_.begin(),heap_.end(),later);
+                    expired.emplace_back(std::move(heap_.back()));
+                    heap_.pop_back();
+                }
+            }
+            else if(deadlineSize_ > 0) {
+                auto keep = fifo_.begin();
+                for(auto it = fifo_.begin();it != fifo_.end();++it) {
+                    if(it -> deadline < now) {
+                        expired.emplace_back(std::move(*it));
+                    }
+                    else {
+                        if(keep != it) {
+                            *keep = std::move(*it);
+                        }
+                        ++keep;
+                    }
+                }
+                fifo_.erase(keep,fifo_.end());
+            }
+            deadlineSize_ -= expired.size() - before;
+            return expired.size() - before;
+        }
+
+        //最早的截止时间，没有带截止时间的任务时返回time_point::max()
+        Clock::time_point earliestDeadline() const {
+            if(mode_ == QueueMode::QUEUE_EDF) {
+                return heap_.empty() ? Clock::time_point::max() : heap_.front().deadline;
+            }
+            Clock::time_point earliest = Clock::time_point::max();
+            if(deadlineSize_ > 0) {
+                for(const Task& task : fifo_) {
+                    earliest = std::min(earliest,task.deadline);
+                }
+            }
+            return earliest;
+        }
+    private:
+        //堆顶是截止时间最早的任务
+        static bool later(const Task& a,const Task& b) {
+            if(a.deadline != b.deadline) {
+                return a.deadline > b.deadline;
+            }
+            return a.seq > b.seq;
+        }
+    private:
+        QueueMode mode_;
+        std::deque<Task> fifo_;
+        std::vector<Task> heap_;
+        size_t deadlineSize_; //带截止时间的任务数量
+    };
+
+    //任务组 每个组有自己的任务队列，组之间按DRR调度
+    struct TaskGroup {
+        TaskGroup(const std::string& name,int weight,int maxConcurrency,QueueMode mode)
+            :name(name),weight(weight),maxConcurrency(maxConcurrency),deficit(0),running(0),isActive(false),
+             submitted(0),completed(0),started(0),totalWait(0),maxWait(0) {
+            que.setMode(mode);
+        }
+
+        //是否达到了并发上限
+        bool isCapped() const {
+            return maxConcurrency > 0 && running >= maxConcurrency;
+        }
+
+        std::string name;
+        int weight;         //每一轮的额度
+        int maxConcurrency; //组内最多同时执行的任务数量，0表示不限制
+        TaskQueue que;      //组内的任务队列
+        int deficit;        //本轮剩余的额度
+        int running;        //正在执行的任务数量
+        bool isActive;      //是否在activeGroups_中
+
+        unsigned long long submitted;
+        unsigned long long completed;
+        unsigned long long started;
+        Clock::duration totalWait;
+        Clock::duration maxWait;
+    };
+
+    //打包任务放入任务队列
+    //packaged_task的参数表示任务是否超时，超时的任务也要执行一次packaged_task，让future里面存上异常，否则get()会一直阻塞
+    template<typename RType,typename Bound>
+    std::future<RType> packTask(const TaskOptions& options,size_t bytes,Bound&& bound) {
+        auto task = std::make_shared<std::packaged_task<RType(bool)>>(
+            [f = std::forward<Bound>(bound)](bool timedOut) mutable -> RType {
+                if(timedOut) {
+                    throw TaskTimeoutError();
+                }
+                return f();
+            });
+        std::future<RType> result = task -> get_future();
+
+        Task t;
+        t.func = [task]() {(*task)(false);}; //增加一个中间层返回值是void不带参数的一个lamda表达式将实际要执行的任务封装起来
+        if(options.deadline != Clock::time_point::max()) {
+            t.expire = [task]() {(*task)(true);};
+        }
+        t.deadline = options.deadline; //没有截止时间的任务永远不会被丢弃
+        t.group = options.group;
+        t.bytes = bytes;
+        return commitTask(std::move(t),std::move(result));
+    }
+
+    //把任务放入任务队列，任务队列满了提交失败，返回一个默认值的future
+    template<typename RType>
+    std::future<RType> commitTask(Task t,std::future<RType> result) {
+        //在等待任务队列空余之前记下到达时间，阻塞的时间和提交失败的任务都能录制下来
+        Clock::time_point arrive;
+        uint32_t thread = 0,depth = 0;
+        if(recorder_ != nullptr) {
+            arrive = Clock::now();
+            thread = WorkloadRecorder::threadIndex();
+            depth = (uint32_t)taskSize_;
+            t.isRecorded = true;
+            t.arriveTime = arrive;
+            t.submitThread = thread;
+            t.queueDepth = depth;
+        }
+        //在持有同一个ResourceManager令牌的任务里面提交，提交者通常会等待结果，新任务借用它的令牌，不会因为令牌用完而死锁
+        t.isLent = ResourceManager::holdsLease(resourceManager_);
+        if(!enqueueTask(std::move(t))) {
+            if(recorder_ != nullptr) {
+                recorder_ -> record(arrive,Clock::now() - arrive,thread,depth,Clock::duration(0),WorkloadRecord::REJECTED);
+            }
+            auto task = std::make_shared<std::packaged_task<RType()>>(
+                []() -> RType {return RType();});
+            (*task)();//执行这个任务，不然不执行获取返回值会崩溃
+            return  task -> get_future();
+        }
+        return result;
+    }
+
+    //估算任务占用的内存：函数对象和所有参数
+    template<typename Func,typename... Args>
+    static size_t estimateBytes(const Func& func,const Args&... args) {
+        return (taskPayloadSize(func) + ... + taskPayloadSize(args));
+    }
+
+    //任务入队，任务队列满1s返回false，bounded为false时不受任务队列上限限制
+    bool enqueueTask(Task task,bool bounded = true) {
+        std::vector<Task> expired; //队列满时清理出来的过期任务，在释放锁之后录制和析构
+        bool isQueued = tryEnqueueTask(std::move(task),bounded,expired);
+        recordExpiredTasks(expired);
+        return isQueued;
+    }
+
+    //enqueueTask的实现，等待空余时清理出来的过期任务放到expired里面
+    bool tryEnqueueTask(Task task,bool bounded,std::vector<Task>& expired) {
+         //获取锁
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        //线程通信 等待任务队列有空余
+        // while(taskQue_.size() == taskQueMaxThreshHold_) {
+        //     notFull_.wait(lock);
+        // }
+        //taskQue_队列满则阻塞，用户提交任务最长不能阻塞1s，否则判断提交任务失败，返回
+        // notFull_.wait(lock,[&]() -> bool {return taskQue_.size() < taskQueMaxThreshHold_;});
+        if(task.group < 0 || task.group >= (int)groups_.size()) {
+            std::cerr << "invalid task group " << task.group << ", submit task fail." << std::endl;
+            return false;
+        }
+        //任务数量和字节数都没有超过阈值才能入队，没有任务占用内存时，超过阈值的大任务也可以入队，否则它永远提交不了
+        auto hasRoom = [&]() -> bool {
+            size_t used = queuedBytes_ + inFlightBytes_;
+            return groups_[task.group] -> que.size() < (size_t) taskQueMaxThreshHold_
+                && (taskQueMaxBytes_ == 0 || used == 0 || used + task.bytes <= taskQueMaxBytes_);
+        };
+        //队列满时先清理已经过期的任务，过期任务不能占着名额挤掉新提交的任务
+        if(bounded && !notFull_.wait_for(lock,std::chrono::milliseconds(submitTimeout_),
+                        [&]() -> bool {
+                            return hasRoom() || (removeExpiredTasks(expired) > 0 && hasRoom());
+                        })) {
+            //表示notFull_等待submitTimeout_，条件依然没有满足。
+            std::cerr << "task queue is full, submit task fail." << std::endl;
+            return false;
+        }
+        respawnAfterFork();
+        //如果有空余，把任务放到任务队列中
+        pushTask(std::move(task));
+        //因为新放了任务，任务队列不为空，在notEmpty上进行通知，赶快分配线程执行任务
+        //已经被唤醒还没有拿到锁的线程不算等待者，连续提交时后面的任务要唤醒epoll_wait的线程
+        bool hasWaiter = condWaitSize_ > 0;
+        notifyNotEmpty();
+        //没有线程在条件变量上等待，只能唤醒正在epoll_wait的线程来取任务
+        if(isPolling_ && !hasWaiter) {
+            wakePoller();
+        }
+
+        //cached模式，任务处理比较紧急 场景：小而快的任务需要根据任务数量和空闲线程数量，判断是否需要新的线程出来
+        //有线程在等待共享线程预算的令牌时，新线程也只能等待，不再创建
+        //线程数量达到令牌总数时，多出来的线程永远不能同时执行，也不再创建
+        if(poolMode_ == PoolMode::MODE_CACHED 
+                && taskSize_ > idleThreadSize_
+                && curThreadSize_ < threadSizeThresdHold_
+                && tokenWaitSize_ == 0
+                && (resourceManager_ == nullptr || curThreadSize_ < resourceManager_ -> getCapacity())) {
+            std::cout << ">>> create new thread ..." << std::endl;
+            //先回收已经退出的线程，它们的栈会回到缓存里面给新线程复用
+            joinExitedThreads();
+            spawnThread();
+        }
+        return true;
+    }
+
     //定义线程函数
     void threadFunc(int threadId){ //线程函数返回，相应的线程也就结束了
         auto lastTime = std::chrono::high_resolution_clock().now();
+        int finishedGroup = -1; //上一个执行完的任务所属的任务组，下次拿到锁时更新任务组的状态
+        size_t finishedBytes = 0; //上一个执行完的任务占用的字节数
         //所有任务必须执行完成，线程池才可以回收所有资源
         for(;;){
             Task task;//自己创建的，生命周期自己负责，无需智能指针
+            bool expired = false;
+            bool hasToken = false; //是否拿到了共享线程预算的令牌
+            bool isLent = false;   //任务是否借用提交者的令牌
             {
                 //先获取锁
                 std::unique_lock<std::mutex> lock(taskQueMtx_);
 
-                std::cout << "tid" << std::this_thread::get_id() << "尝试获取任务" << std::endl;
+                THREADPOOL_LOG("tid" << std::this_thread::get_id() << "尝试获取任务");
 
-                //有任务不会回收资源，必须任务执行完成任务队列为空
-                while(taskQue_.size() == 0) {
-                    //线程池要结束，回收线程资源
-                    if(!isPoolRunning_) { //回收资源
-                        threads_.erase(threadId);
-                        std::cout << "threadid:" << std::this_thread::get_id() << " exit!" << std::endl;
-                        exitCond_.notify_all(); //通知主线程（用户线程）退出
-                        return; //线程函数结束，线程结束。
-                    }
-                    //在cache模式下，可能已经创建了很多的线程，但是空闲时间超过60s的话，应该把多余的线程结束回收掉
-                    //超过initThreadSize_数量的线程要进行回收
-                    //当前时间-上一次线程执行的时间 超过 60s
-                    if(poolMode_ == PoolMode::MODE_CACHED) {
-                        //每一秒返回一次 怎么区分超时返回和有任务待执行返回
-                        //条件变量超时返回了
-                        if(std::cv_status::timeout == notEmpty_.wait_for(lock,std::chrono::seconds(1))) {
+                if(finishedGroup >= 0) {
+                    finishTask(finishedGroup);
+                    finishedGroup = -1;
+                }
+                if(finishedBytes > 0) {
+                    //任务执行完释放了内存，等待字节数额度的提交者可以继续
+                    inFlightBytes_ -= finishedBytes;
+                    finishedBytes = 0;
+                    notFull_.notify_all();
+                }
+
+                //任务一直不断的时候没有线程去epoll_wait，到期的定时器在这里放入任务队列
+                if(!timers_.empty()) {
+                    pushDueTimers();
+                }
+
+                //共享线程预算时先拿到令牌再取任务：等待令牌期间任务留在队列里面，截止时间和等待时间按真正开始执行的时刻计算
+                for(;;) {
+                    //有任务不会回收资源，必须任务执行完成任务队列为空
+                    while(activeGroups_.empty() && lentTasks_.empty()) {
+                        //拿到令牌时任务已经被其他线程取走了，空闲线程不能占着令牌
+                        if(hasToken) {
+                            lock.unlock();
+                            resourceManager_ -> release();
+                            lock.lock();
+                            hasToken = false;
+                            continue;
+                        }
+                        //线程池要结束，回收线程资源
+                        if(!isPoolRunning_) { //回收资源
+                            retireThread(threadId);
+                            std::cout << "threadid:" << std::this_thread::get_id() << " exit!" << std::endl;
+                            exitCond_.notify_all(); //通知主线程（用户线程）退出
+                            return; //线程函数结束，线程结束。
+                        }
+                        //任务队列为空时，空闲线程中的一个负责epoll_wait等待I/O事件，其余的在条件变量上等待
+                        bool timeout = false;
+                        if(!isPolling_) {
+                            timeout = pollIo(lock,poolMode_ == PoolMode::MODE_CACHED ? 1000 : -1);
+                        }
+                        else if(poolMode_ == PoolMode::MODE_CACHED) {
+                            //每一秒返回一次 怎么区分超时返回和有任务待执行返回
+                            condWaitSize_++;
+                            unsigned long long seq = notifySeq_;
+                            timeout = std::cv_status::timeout == notEmpty_.wait_for(lock,std::chrono::seconds(1));
+                            if(seq == notifySeq_) {
+                                condWaitSize_--; //超时或者虚假唤醒，被唤醒时已经在notifyNotEmpty里面减掉了
+                            }
+                        }
+                        else{
+                            //等待notEmpty条件
+                            condWaitSize_++;
+                            unsigned long long seq = notifySeq_;
+                            notEmpty_.wait(lock);
+                            if(seq == notifySeq_) {
+                                condWaitSize_--;
+                            }
+                        }
+
+                        //在cache模式下，可能已经创建了很多的线程，但是空闲时间超过60s的话，应该把多余的线程结束回收掉
+                        //超过initThreadSize_数量的线程要进行回收
+                        //当前时间-上一次线程执行的时间 超过 60s
+                        if(poolMode_ == PoolMode::MODE_CACHED && timeout) {
                             auto now = std::chrono::high_resolution_clock().now();
                             auto dur = std::chrono::duration_cast<std::chrono::seconds>(now - lastTime);
-                            if(dur.count() >= THREAD_MAX_IDLE_TIME && curThreadSize_ > initThreadSize_) {
+                            if(dur.count() >= threadMaxIdleTime_ && curThreadSize_ > initThreadSize_) {
                                 //开始回收当前线程
                                 //记录线程数量的相关变量的值修改
                                 //把线程对象从线程列表容器中删除，怎么删除当前的线程对应的线程对象，怎么根据ThreadFunc找到Thread对象？方法：增加threadId
-                                threads_.erase(threadId);
+                                retireThread(threadId);
                                 curThreadSize_--;
                                 idleThreadSize_--;
                                 std::cout << "threadid:" << std::this_thread::get_id() << "exit!" << std::endl;
                                 return;
-                                
                             }
                         }
                     }
-                    else{
-                        //等待notEmpty条件
-                        notEmpty_.wait(lock);
+                    //借用令牌的任务不用等令牌
+                    if(resourceManager_ == nullptr || hasToken || !lentTasks_.empty()) {
+                        break;
                     }
+                    //等待令牌的线程仍然算空闲线程，tokenWaitSize_让cached模式不再为排队的任务创建新线程
+                    //等待期间有借用令牌的任务入队时被wakeWaiters唤醒，回来执行它
+                    tokenWaitSize_++;
+                    unsigned long long wakeSeq = resourceManager_ -> getWakeSeq(resourcePoolId_);
+                    lock.unlock();
+                    hasToken = resourceManager_ -> acquire(resourcePoolId_,wakeSeq);
+                    lock.lock();
+                    tokenWaitSize_--;
                 }
 
                 idleThreadSize_--;
 
-                std::cout << "tid" << std::this_thread::get_id() << "获取任务成功" << std::endl;
-                //从任务队列中取一个任务出来
-                task = taskQue_.front();
-                taskQue_.pop();
-                taskSize_--;
+                THREADPOOL_LOG("tid" << std::this_thread::get_id() << "获取任务成功");
+                //从任务队列中取一个任务出来，拿到令牌时优先执行任务组里面的任务，借用令牌的任务留给没有令牌的线程
+                isLent = !lentTasks_.empty() && (!hasToken || activeGroups_.empty());
+                task = isLent ? popLentTask() : popTask();
+                //截止时间已过的任务不再执行，直接丢弃
+                expired = task.deadline != Clock::time_point::max() && task.deadline < Clock::now();
                 //如果依然有剩余任务，继续通知其他线程执行任务
-                if(taskQue_.size() > 0) {
-                    notEmpty_.notify_all();
+                if(!activeGroups_.empty() || !lentTasks_.empty()) {
+                    //条件变量上没有线程可以唤醒时，让epoll_wait的线程来取剩下的任务
+                    if(condWaitSize_ == 0 && isPolling_) {
+                        wakePoller();
+                    }
+                    notifyNotEmpty();
                 }
                 //取出一个任务，进行通知,通知可以继续提交生产任务。
                 notFull_.notify_all();
             }//就应该把锁释放掉,不能让线程拿着锁去执行任务！
 
             //当前线程负责执行这个任务 
-            if(task != nullptr) {
-                task(); // 执行function<void()>
+            Clock::duration runTime(0);
+            currentWorker_ = {this,threadId,task.group,task.bytes};
+            //借用的令牌让任务里面再提交的任务也能借用，BlockingScope不会归还它
+            bool isBorrowing = isLent && !hasToken;
+            if(isBorrowing) {
+                resourceManager_ -> borrow(resourcePoolId_);
+            }
+            if(expired) {
+                task.expire(); //通知future任务已超时
+                expiredTaskSize_++;
+            }
+            else if(task.func != nullptr) {
+                auto begin = task.isRecorded ? Clock::now() : Clock::time_point();
+                //submitTask的任务异常存在future里面，这里只有watchFd、定时器、execute的回调会抛出
+                //回调抛出的异常没有人接收，记录之后丢弃，不能让它结束工作线程进而终止整个进程
+                try {
+                    task.func(); // 执行function<void()>
+                }
+                catch(const std::exception& e) {
+                    failedCallbackSize_++;
+                    std::cerr << "callback threw exception: " << e.what() << std::endl;
+                }
+                catch(...) {
+                    failedCallbackSize_++;
+                    std::cerr << "callback threw unknown exception" << std::endl;
+                }
+                if(task.isRecorded) {
+                    runTime = Clock::now() - begin;
+                }
+            }
+            currentWorker_.pool = nullptr;
+            if(hasToken || isBorrowing) {
+                resourceManager_ -> release();
+            }
+            if(task.isRecorded) {
+                recordTask(task,runTime,expired ? WorkloadRecord::EXPIRED : 0);
             }
+            finishedGroup = task.group;
+            finishedBytes = task.bytes;
             idleThreadSize_++;
             lastTime = std::chrono::high_resolution_clock().now(); //更新线程执行完任务的时间
         }
     }
 
+    //在epoll上等待I/O事件，就绪fd的回调作为任务放入任务队列，超时返回true
+    //调用时持有taskQueMtx_，epoll_wait期间释放锁
+    bool pollIo(std::unique_lock<std::mutex>& lock,int timeoutMs){
+        //有定时器的话，最多等到最早的定时器到期
+        if(!timers_.empty()) {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                timers_.front().when - Clock::now() + std::chrono::microseconds(999)).count();
+            wait = std::max<long long>(wait,0);
+            if(timeoutMs < 0 || wait < timeoutMs) {
+                timeoutMs = (int)wait;
+            }
+        }
+        isPolling_ = true;
+        lock.unlock();
+        epoll_event events[EPOLL_MAX_EVENTS];
+        int n = ::epoll_wait(epollFd_,events,EPOLL_MAX_EVENTS,timeoutMs);
+        lock.lock();
+        isPolling_ = false;
+
+        for(int i = 0;i < n;i++) {
+            int fd = events[i].data.fd;
+            if(fd == wakeFd_) {
+                uint64_t cnt;
+                ::read(wakeFd_,&cnt,sizeof(cnt));
+                continue;
+            }
+            auto it = ioWatches_.find(fd);
+            if(it == ioWatches_.end() || it -> second.isReady) {
+                continue;
+            }
+            //I/O回调不受任务队列上限的限制，否则就绪事件会丢失
+            //监听记录留到回调执行时才删除，排队期间unwatchFd还可以取消它
+            Task task;
+            uint32_t revents = events[i].events;
+            unsigned long long seq = it -> second.seq;
+            task.func = [this,fd,seq,revents]() {runIoCallback(fd,seq,revents);};
+            task.deadline = Clock::time_point::max();
+            pushTask(std::move(task));
+            it -> second.isReady = true;
+        }
+        int due = timers_.empty() ? 0 : pushDueTimers();
+        //当前线程不再等待I/O，让条件变量上等待的线程接手epoll_wait或者执行新任务
+        if(n != 0 || due != 0 || condWaitSize_ > 0) {
+            notifyNotEmpty();
+        }
+        return n == 0 && due == 0;
+    }
+
+    //任务放入所属任务组的队列，调用时持有taskQueMtx_
+    void pushTask(Task task){
+        TaskGroup& group = *groups_[task.group];
+        task.seq = taskSeq_++;
+        task.submitTime = Clock::now();
+        if(task.deadline < nextDeadline_) {
+            nextDeadline_ = task.deadline;
+            armDeadline();
+        }
+        queuedBytes_ += task.bytes;
+        if(task.isLent) {
+            //借用令牌的任务不进任务组的轮转，等待令牌的线程要回来执行它
+            group.submitted++;
+            taskSize_++;
+            lentTasks_.push_back(std::move(task));
+            if(tokenWaitSize_ > 0) {
+                resourceManager_ -> wakeWaiters(resourcePoolId_);
+            }
+            return;
+        }
+        group.que.push(std::move(task));
+        group.submitted++;
+        taskSize_++;
+        if(!group.isActive && !group.isCapped()) {
+            group.isActive = true;
+            activeGroups_.push_back(&group);
+        }
+    }
+
+    //取出借用令牌的任务，调用时持有taskQueMtx_，lentTasks_不能为空
+    //这类任务不受任务组的额度和并发上限限制，执行完同样由finishTask更新任务组的状态
+    Task popLentTask(){
+        Task task = std::move(lentTasks_.front());
+        lentTasks_.pop_front();
+        TaskGroup& group = *groups_[task.group];
+        taskSize_--;
+        queuedBytes_ -= task.bytes;
+        inFlightBytes_ += task.bytes;
+        group.running++;
+        group.started++;
+        auto wait = Clock::now() - task.submitTime;
+        group.totalWait += wait;
+        group.maxWait = std::max(group.maxWait,wait);
+        return task;
+    }
+
+    //按DRR取出下一个任务，调用时持有taskQueMtx_，activeGroups_不能为空
+    //轮到一个组时给它weight个额度，额度用完或者队列空了就换下一个组，每次都是O(1)
+    Task popTask(){
+        TaskGroup& group = *activeGroups_.front();
+        if(group.deficit == 0) {
+            group.deficit = group.weight;
+        }
+        Task task = group.que.pop();
+        taskSize_--;
+        queuedBytes_ -= task.bytes;
+        inFlightBytes_ += task.bytes;
+        group.deficit--;
+        group.running++;
+        group.started++;
+        auto wait = Clock::now() - task.submitTime;
+        group.totalWait += wait;
+        group.maxWait = std::max(group.maxWait,wait);
+
+        if(group.que.size() == 0 || group.isCapped()) {
+            //队列空了或者达到并发上限，先退出轮转
+            activeGroups_.pop_front();
+            group.isActive = false;
+            if(group.que.size() == 0) {
+                group.deficit = 0;
+            }
+        }
+        else if(group.deficit == 0) {
+            activeGroups_.pop_front();
+            activeGroups_.push_back(&group);
+        }
+        return task;
+    }
+
+    //截止时间最早的任务提前时唤醒deadlineThread_，还没有创建时创建它，调用时持有taskQueMtx_
+    void armDeadline(){
+        if(deadlineThread_ == nullptr) {
+            deadlineThread_ = std::make_unique<Thread>(std::bind(&ThreadPool::deadlineFunc,this,std::placeholders::_1),threadAttr_);
+            deadlineThread_ -> start();
+        }
+        else {
+            deadlineCond_.notify_one();
+        }
+    }
+
+    //等到排队任务中最早的截止时间，清理过期的任务
+    //所有工作线程都在忙时，超时任务的future也能在截止时间附近失败，而不是等到有线程空闲
+    void deadlineFunc(int){
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        while(isPoolRunning_) {
+            if(nextDeadline_ == Clock::time_point::max()) {
+                deadlineCond_.wait(lock);
+                continue;
+            }
+            if(Clock::now() <= nextDeadline_) {
+                deadlineCond_.wait_until(lock,nextDeadline_ + std::chrono::microseconds(1));
+                continue;
+            }
+            std::vector<Task> expired;
+            removeExpiredTasks(expired);
+            nextDeadline_ = Clock::time_point::max();
+            for(auto& group : groups_) {
+                nextDeadline_ = std::min(nextDeadline_,group -> que.earliestDeadline());
+            }
+            //过期任务的录制和析构在锁外面进行
+            lock.unlock();
+            recordExpiredTasks(expired);
+            expired.clear();
+            lock.lock();
+        }
+    }
+
+    //录制一个已经入队的任务，阻塞时间是从调用submitTask到入队
+    void recordTask(const Task& task,Clock::duration run,uint32_t flags){
+        recorder_ -> record(task.arriveTime,task.submitTime - task.arriveTime,task.submitThread,task.queueDepth,run,flags);
+    }
+
+    //录制清理出来的过期任务，在释放taskQueMtx_之后调用，写文件时不挡住其他线程取任务
+    void recordExpiredTasks(const std::vector<Task>& expired){
+        for(const Task& task : expired) {
+            if(task.isRecorded) {
+                recordTask(task,Clock::duration(0),WorkloadRecord::EXPIRED);
+            }
+        }
+    }
+
+    //从所有任务组里面取出截止时间已过的任务，通知它们的future超时，返回取出的数量
+    //调用时持有taskQueMtx_，expire只设置future的异常，不执行用户代码，也不录制，由调用者释放锁之后录制
+    size_t removeExpiredTasks(std::vector<Task>& expired){
+        size_t before = expired.size();
+        auto now = Clock::now();
+        for(auto& group : groups_) {
+            size_t n = group -> que.removeExpired(now,expired);
+            if(n == 0) {
+                continue;
+            }
+            group -> completed += n;
+            taskSize_ -= n;
+            //队列空了的组退出轮转，popTask要求activeGroups_里面的组都有任务
+            if(group -> que.size() == 0) {
+                group -> deficit = 0;
+                if(group -> isActive) {
+                    group -> isActive = false;
+                    activeGroups_.erase(std::find(activeGroups_.begin(),activeGroups_.end(),group.get()));
+                }
+            }
+        }
+        for(size_t i = before;i < expired.size();i++) {
+            queuedBytes_ -= expired[i].bytes;
+            expired[i].expire();
+        }
+        expiredTaskSize_ += expired.size() - before;
+        if(expired.size() > before) {
+            notFull_.notify_all();
+        }
+        return expired.size() - before;
+    }
+
+    //任务执行完，更新任务组的状态，调用时持有taskQueMtx_
+    void finishTask(int groupId){
+        TaskGroup& group = *groups_[groupId];
+        group.running--;
+        group.completed++;
+        //因为并发上限退出轮转的组重新加入
+        if(!group.isActive && group.que.size() > 0 && !group.isCapped()) {
+            group.isActive = true;
+            activeGroups_.push_back(&group);
+        }
+    }
+
+    //把到期的定时器放入任务队列，返回放入的数量，调用时持有taskQueMtx_
+    int pushDueTimers(){
+        int due = 0;
+        auto now = Clock::now();
+        while(!timers_.empty() && timers_.front().when <= now) {
+            std::pop_heap(timers_.begin(),timers_.end(),timerLater);
+            Task task;
+            task.func = std::move(timers_.back().func);
+            task.deadline = Clock::time_point::max();
+            pushTask(std::move(task));
+            timers_.pop_back();
+            due++;
+        }
+        return due;
+    }
+
+    //注册fd的监听，成功返回0，失败返回错误码，线程池没有启动时返回ECANCELED
+    int addWatch(int fd,uint32_t events,std::function<void(uint32_t)> callback){
+        std::unique_lock<std::mutex> lock(taskQueMtx_);
+        if(!isPoolRunning_ || epollFd_ < 0) {
+            return ECANCELED;
+        }
+        respawnAfterFork();
+        epoll_event ev{};
+        ev.events = events | EPOLLONESHOT;
+        ev.data.fd = fd;
+        //ONESHOT触发后fd还留在epoll里面，只是被禁用了，再次注册用EPOLL_CTL_MOD
+        if(::epoll_ctl(epollFd_,EPOLL_CTL_ADD,fd,&ev) < 0) {
+            if(errno != EEXIST || ::epoll_ctl(epollFd_,EPOLL_CTL_MOD,fd,&ev) < 0) {
+                return errno;
+            }
+        }
+        ioWatches_[fd] = {std::move(callback),ioWatchSeq_++,false};
+        return 0;
+    }
+
+    //执行就绪fd的回调，监听在排队期间被取消或者被重新注册时不执行
+    void runIoCallback(int fd,unsigned long long seq,uint32_t revents){
+        std::function<void(uint32_t)> callback;
+        {
+            std::unique_lock<std::mutex> lock(taskQueMtx_);
+            auto it = ioWatches_.find(fd);
+            if(it == ioWatches_.end() || it -> second.seq != seq) {
+                return;
+            }
+            callback = std::move(it -> second.callback);
+            ioWatches_.erase(it);
+        }
+        callback(revents);
+    }
+
+    //创建并启动一个工作线程，调用时持有taskQueMtx_
+    void spawnThread(){
+        std::unique_ptr<Thread> ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc,this,std::placeholders::_1),threadAttr_);
+        int threadId = ptr -> getId();
+        threads_.emplace(threadId,std::move(ptr));
+        //启动线程
+        threads_[threadId] -> start();
+        //修改线程个数相关数量
+        curThreadSize_++;
+        idleThreadSize_++;
+    }
+
+    //创建epoll，空闲线程在上面等待I/O事件，eventfd用来在提交任务时唤醒它
+    void createReactor(){
+        epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        wakeFd_ = ::eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = wakeFd_;
+        ::epoll_ctl(epollFd_,EPOLL_CTL_ADD,wakeFd_,&ev);
+    }
+
+    //fork之后的子进程里面第一次使用线程池时重新创建工作线程，调用时持有taskQueMtx_
+    void respawnAfterFork(){
+        if(needRespawn_) {
+            needRespawn_ = false;
+            //在任务里面fork时调用fork的工作线程还在执行任务，新线程照样创建initThreadSize_个，任务里面等待其他任务的结果不会死锁
+            for(size_t i = 0;i < initThreadSize_;i++) {
+                spawnThread();
+            }
+        }
+    }
+
+    static ThreadPool* createGlobal(){
+        ThreadPool* pool = new ThreadPool(); //故意不析构，进程退出时可能还有其他静态对象在使用它
+        pool -> setTaskQueMaxThreshHold(GLOBAL_TASK_MAX_THRESHHOLD);
+        pool -> start();
+        globalPool_ = pool;
+        pthread_atfork(&ThreadPool::prepareFork,&ThreadPool::parentAfterFork,&ThreadPool::childAfterFork);
+        return pool;
+    }
+
+    //fork之前拿到所有的锁，子进程里面的任务队列和栈缓存才是一致的
+    static void prepareFork(){
+        globalPool_ -> taskQueMtx_.lock();
+        StackCache::instance().lockForFork();
+    }
+
+    static void parentAfterFork(){
+        StackCache::instance().unlockForFork();
+        globalPool_ -> taskQueMtx_.unlock();
+    }
+
+    //子进程里面只有调用fork的线程，线程池的工作线程都不存在了，把线程池恢复到刚启动的状态
+    static void childAfterFork(){
+        StackCache::instance().unlockForFork();
+        ThreadPool* pool = globalPool_;
+        pool -> resetAfterFork();
+        pool -> taskQueMtx_.unlock();
+    }
+
+    void resetAfterFork(){
+        //在任务里面fork时，调用fork的工作线程在子进程里面继续执行这个任务，它的Thread对象和任务占用的额度要保留
+        bool inTask = currentWorker_.pool == this;
+        std::unique_ptr<Thread> self;
+        if(inTask) {
+            self = std::move(threads_[currentWorker_.threadId]);
+            threads_.erase(currentWorker_.threadId);
+        }
+        //父进程的其他线程不能join，Thread对象只回收栈
+        for(auto& thread : threads_) {
+            thread.second -> abandon();
+        }
+        for(auto& thread : exitedThreads_) {
+            thread -> abandon();
+        }
+        threads_.clear();
+        exitedThreads_.clear();
+        curThreadSize_ = 0;
+        idleThreadSize_ = 0;
+        tokenWaitSize_ = 0;
+        if(inTask) {
+            threads_.emplace(currentWorker_.threadId,std::move(self));
+            curThreadSize_ = 1; //任务执行完以后它才变成空闲线程
+        }
+
+        //排队的任务丢弃，除了调用fork的线程，父进程里面正在执行的任务在子进程里面不存在
+        for(auto& group : groups_) {
+            TaskQueue que;
+            que.setMode(queueMode_);
+            group -> que = std::move(que);
+            group -> deficit = 0;
+            group -> running = 0;
+            group -> isActive = false;
+        }
+        activeGroups_.clear();
+        lentTasks_.clear();
+        taskSize_ = 0;
+        queuedBytes_ = 0;
+        inFlightBytes_ = 0;
+        if(inTask) {
+            groups_[currentWorker_.group] -> running = 1;
+            inFlightBytes_ = currentWorker_.bytes;
+        }
+        timers_.clear();
+
+        //epoll实例和父进程共享，子进程要创建自己的
+        ::close(epollFd_);
+        ::close(wakeFd_);
+        ioWatches_.clear();
+        createReactor();
+        isPolling_ = false;
+        condWaitSize_ = 0;
+
+        //父进程的线程可能正在条件变量上等待，子进程里面重新构造
+        new (&notFull_) std::condition_variable();
+        new (&notEmpty_) std::condition_variable();
+        new (&exitCond_) std::condition_variable();
+        new (&deadlineCond_) std::condition_variable();
+        if(deadlineThread_ != nullptr) {
+            deadlineThread_ -> abandon();
+            deadlineThread_.reset();
+        }
+        nextDeadline_ = Clock::time_point::max();
+
+        needRespawn_ = true;
+    }
+
+    //线程退出时调用，线程不能join自己，先把Thread对象移到exitedThreads_，由其他线程join
+    void retireThread(int threadId){
+        auto it = threads_.find(threadId);
+        exitedThreads_.emplace_back(std::move(it -> second));
+        threads_.erase(it);
+    }
+
+    //join已经退出的线程，调用时持有taskQueMtx_
+    void joinExitedThreads(){
+        exitedThreads_.clear();
+    }
+
+    //唤醒notEmpty_上等待的所有线程，被唤醒的线程不再算作等待者，调用时持有taskQueMtx_
+    void notifyNotEmpty(){
+        notEmpty_.notify_all();
+        condWaitSize_ = 0;
+        notifySeq_++;
+    }
+
+    //唤醒阻塞在epoll_wait上的线程
+    void wakePoller(){
+        if(wakeFd_ >= 0) {
+            uint64_t one = 1;
+            ::write(wakeFd_,&one,sizeof(one));
+        }
+    }
+
     //检查pool 运行状态
     bool checkRunningState() const{
         return isPoolRunning_;
@@ -282,21 +1917,52 @@ private:
 private:
     // std::vector<std::unique_ptr<Thread>> threads_; //线程列表
     std::unordered_map<int,std::unique_ptr<Thread>> threads_;//线程列表
+    std::vector<std::unique_ptr<Thread>> exitedThreads_; //已经退出、等待join的线程
+    ThreadAttr threadAttr_; //创建线程使用的属性
+    int threadMaxIdleTime_; //cached模式下多余线程的最长空闲时间
+    ResourceManager* resourceManager_; //共享的线程预算，nullptr表示不受限制
+    int resourcePoolId_; //在resourceManager_中的id
+    int tokenWaitSize_; //正在等待令牌的线程数量
+    WorkloadRecorder* recorder_; //负载录制器，nullptr表示不录制
     size_t initThreadSize_; //初始线程数量
     std::atomic_int curThreadSize_;//记录当前线程池里面现成数量
     std::atomic_int idleThreadSize_;//记录空闲线程的数量
     int threadSizeThresdHold_; //现成数量上限阈值
 
-    //Task任务 -》 函数对象
-    using Task = std::function<void()>;
-    std::queue<Task> taskQue_;  //任务队列
+    std::vector<std::unique_ptr<TaskGroup>> groups_; //任务组，下标就是组id
+    std::deque<TaskGroup*> activeGroups_; //有任务可以执行的任务组，按DRR轮转
+    std::deque<Task> lentTasks_; //借用提交者令牌的任务，不用等令牌，优先执行
+    QueueMode queueMode_; //任务队列的调度方式
     std::atomic_uint taskSize_; //任务的数量
     int taskQueMaxThreshHold_;  //任务队列数量上限阈值
+    unsigned long long taskSeq_; //任务提交序号
+    std::atomic_uint expiredTaskSize_; //超过截止时间被丢弃的任务数量
+    std::atomic_uint failedCallbackSize_; //抛出异常的回调数量
+    size_t taskQueMaxBytes_; //任务占用内存的上限阈值，0表示不限制
+    std::atomic_size_t queuedBytes_; //排队中的任务占用的字节数
+    std::atomic_size_t inFlightBytes_; //正在执行的任务占用的字节数
+    int submitTimeout_; //任务队列满时提交任务最长的阻塞时间，单位：毫秒
+    bool needRespawn_; //fork之后子进程里面需要重新创建工作线程
+    inline static ThreadPool* globalPool_ = nullptr; //全局线程池，fork处理函数使用
+    inline static thread_local WorkerContext currentWorker_ = {nullptr,-1,0,0};
 
     std::mutex taskQueMtx_; // 保证任务队列的线程安全
     std::condition_variable notFull_; //任务队列不满
     std::condition_variable notEmpty_; //任务队列不空
     std::condition_variable exitCond_; //等待线程资源全部回收
+    std::condition_variable deadlineCond_; //最早的截止时间提前或者线程池结束时唤醒deadlineThread_
+
+    int epollFd_; //等待I/O事件的epoll
+    int wakeFd_;  //eventfd，用来唤醒epoll_wait中的线程
+    std::unordered_map<int,IoWatch> ioWatches_; //fd -> 就绪回调
+    unsigned long long ioWatchSeq_; //监听序号，区分同一个fd的不同次注册
+    bool isPolling_; //是否有线程正在epoll_wait
+    int condWaitSize_; //在notEmpty_上等待、还没有被唤醒的线程数量
+    unsigned long long notifySeq_; //notEmpty_唤醒的次数，等待的线程用来区分被唤醒和超时返回
+    std::vector<Timer> timers_; //定时器小根堆
+    unsigned long long timerSeq_; //定时器序号
+    std::unique_ptr<Thread> deadlineThread_; //到截止时间清理过期任务的线程，第一次提交带截止时间的任务时创建
+    Clock::time_point nextDeadline_; //排队任务中最早的截止时间，没有时为time_point::max()
 
     PoolMode poolMode_; //当前线程池的工作模式
     //表示当前线程池的启动状态
@@ -0,0 +1,193 @@
+#include <iostream>
+#include <vector>
+#include <future>
+#include <atomic>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include "threadpoolfinal.h"
+using namespace std;
+
+/*
+负载录制和重放：
+replayworkload record <文件> [任务数]        用合成的突发负载运行一个录制中的线程池，生成录制文件
+replayworkload <文件> [fixed|cached] [线程数]  按录制的到达时间重新提交任务，任务忙等录制的执行时间，输出吞吐量和延迟分位数
+录制时被拒绝或者超时丢弃的任务也是到达的负载，重放时按已执行任务的平均执行时间提交
+不带参数时先录制workload.trace，再分别用fixed和cached模式重放
+*/
+const size_t REPLAY_MAX_SUBMITTER = 16; // 重放时最多的提交线程数量
+
+using Clock = chrono::steady_clock;
+
+//忙等dur，模拟占用CPU的任务
+void busyWork(Clock::duration dur) {
+    auto end = Clock::now() + dur;
+    while(Clock::now() < end) {}
+}
+
+//提交线程睡到when，最后一小段忙等，提交时间更准
+void waitUntil(Clock::time_point when) {
+    if(when - Clock::now() > chrono::microseconds(200)) {
+        this_thread::sleep_until(when - chrono::microseconds(100));
+    }
+    while(Clock::now() < when) {}
+}
+
+void recordWorkload(const char* path, size_t taskSize) {
+    WorkloadRecorder recorder(path);
+    if(!recorder.isOpen()) {
+        return;
+    }
+    {
+        ThreadPool pool;
+        pool.setRecorder(recorder);
+        pool.setTaskQueMaxThreshHold(taskSize);
+        pool.start(2);
+        //4个提交线程，泊松到达，偶尔一次突发提交20个任务，执行时间是对数正态分布
+        const int submitters = 4;
+        vector<thread> threads;
+        for(int t = 0; t < submitters; t++) {
+            threads.emplace_back([&, t]() {
+                mt19937 rng(t);
+                exponential_distribution<double> gap(1.0 / 800);    //平均间隔800us
+                lognormal_distribution<double> run(log(50.0), 0.8); //执行时间中位数50us
+                auto next = Clock::now();
+                for(size_t i = t, k = 0; i < taskSize; i += submitters, k++) {
+                    if(k % 50 < 5) {
+                        next += chrono::microseconds(5);
+                    }
+                    else {
+                        next += chrono::microseconds((long long)gap(rng));
+                    }
+                    waitUntil(next);
+                    auto dur = chrono::microseconds((long long)run(rng));
+                    pool.submitTask([dur]() {busyWork(dur);});
+                }
+            });
+        }
+        for(auto& t : threads) {
+            t.join();
+        }
+    } //线程池析构时等待所有任务执行完
+    recorder.close();
+    cout << "recorded " << recorder.getRecordSize() << " tasks to " << path << endl;
+}
+
+//已执行任务的平均执行时间，单位：纳秒
+uint64_t meanRunNs(const vector<WorkloadRecord>& records) {
+    uint64_t total = 0, executed = 0;
+    for(auto& r : records) {
+        if(r.flags == 0) {
+            total += r.runNs;
+            executed++;
+        }
+    }
+    return executed == 0 ? 0 : total / executed;
+}
+
+void replay(const vector<WorkloadRecord>& records, PoolMode mode, int threadSize) {
+    size_t n = records.size();
+    uint64_t meanRun = meanRunNs(records);
+    ThreadPool pool;
+    pool.setMode(mode);
+    pool.setTaskQueMaxThreshHold(n + 1);
+    pool.start(threadSize);
+
+    //每个录制的提交线程由一个重放线程按原来的顺序提交
+    vector<vector<size_t>> submitters(REPLAY_MAX_SUBMITTER);
+    for(size_t i = 0; i < n; i++) {
+        submitters[records[i].thread % REPLAY_MAX_SUBMITTER].push_back(i);
+    }
+    uint64_t base = records[0].submitNs;
+    auto start = Clock::now() + chrono::milliseconds(10);
+    auto arrival = [&](size_t i) {return start + chrono::nanoseconds(records[i].submitNs - base);};
+
+    vector<long long> latency(n, -1); //从计划到达到执行完成，单位：微秒，-1表示提交失败
+    vector<Clock::time_point> finish(n);
+    vector<thread> threads;
+    for(auto& indexes : submitters) {
+        if(indexes.empty()) {
+            continue;
+        }
+        threads.emplace_back([&]() {
+            vector<future<void>> results;
+            for(size_t i : indexes) {
+                waitUntil(arrival(i));
+                results.push_back(pool.submitTask([&, i]() {
+                    busyWork(chrono::nanoseconds(records[i].flags == 0 ? records[i].runNs : meanRun));
+                    finish[i] = Clock::now();
+                    latency[i] = chrono::duration_cast<chrono::microseconds>(finish[i] - arrival(i)).count();
+                }));
+            }
+            for(auto& f : results) {
+                f.get();
+            }
+        });
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+
+    vector<long long> done;
+    Clock::time_point last = start;
+    for(size_t i = 0; i < n; i++) {
+        if(latency[i] >= 0) {
+            done.push_back(latency[i]);
+            last = max(last, finish[i]);
+        }
+    }
+    sort(done.begin(), done.end());
+    auto pct = [&](double p) {return done.empty() ? 0 : done[min(done.size() - 1, (size_t)(p * done.size()))];};
+    double sec = chrono::duration<double>(last - start).count();
+    cout << (mode == PoolMode::MODE_FIXED ? "MODE_FIXED " : "MODE_CACHED") << " threads " << threadSize
+         << ": " << done.size() / sec << " tasks/s, latency p50 " << pct(0.5) << " us, p90 " << pct(0.9)
+         << " us, p99 " << pct(0.99) << " us, max " << (done.empty() ? 0 : done.back())
+         << " us, failed " << n - done.size() << endl;
+}
+
+//录制文件的概况
+void summary(const vector<WorkloadRecord>& records) {
+    double depth = 0, block = 0;
+    uint32_t maxDepth = 0, maxBlock = 0;
+    size_t rejected = 0, expired = 0;
+    for(auto& r : records) {
+        depth += r.queueDepth;
+        maxDepth = max(maxDepth, r.queueDepth);
+        block += r.blockUs;
+        maxBlock = max(maxBlock, r.blockUs);
+        rejected += (r.flags & WorkloadRecord::REJECTED) != 0;
+        expired += (r.flags & WorkloadRecord::EXPIRED) != 0;
+    }
+    double sec = (records.back().submitNs - records.front().submitNs) / 1e9;
+    cout << records.size() << " tasks over " << sec << " s, mean run " << meanRunNs(records) / 1000.0
+         << " us, mean queue depth " << depth / records.size() << ", max queue depth " << maxDepth << endl;
+    cout << "submit blocked: mean " << block / records.size() << " us, max " << maxBlock
+         << " us, rejected " << rejected << ", expired " << expired << endl;
+}
+
+int main(int argc, char** argv) {
+    if(argc >= 3 && strcmp(argv[1], "record") == 0) {
+        recordWorkload(argv[2], argc >= 4 ? strtoull(argv[3], nullptr, 10) : 10000);
+        return 0;
+    }
+    const char* path = argc >= 2 ? argv[1] : "workload.trace";
+    if(argc < 2) {
+        recordWorkload(path, 10000);
+    }
+    vector<WorkloadRecord> records = WorkloadRecorder::load(path);
+    if(records.empty()) {
+        return 1;
+    }
+    summary(records);
+    int threadSize = argc >= 4 ? atoi(argv[3]) : 2;
+    if(argc >= 3) {
+        replay(records, strcmp(argv[2], "cached") == 0 ? PoolMode::MODE_CACHED : PoolMode::MODE_FIXED, threadSize);
+    }
+    else {
+        replay(records, PoolMode::MODE_FIXED, threadSize);
+        replay(records, PoolMode::MODE_CACHED, threadSize);
+    }
+    return 0;
+}
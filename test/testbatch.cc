@@ -0,0 +1,92 @@
+#include <iostream>
+#include <vector>
+#include <future>
+#include <cstdint>
+#include "batchexecutor.h"
+using namespace std;
+
+/*
+大量很小的任务(逐条记录计算哈希)：
+1、每条记录单独submitTask
+2、BatchExecutor攒批之后作为一个任务执行
+比较每秒处理的记录条数
+批处理的校验和和逐条提交的不一致，或者linger没有处理凑不满一批的数据，返回非0
+*/
+const size_t ITEM_SIZE = 200000;
+
+//splitmix64
+inline uint64_t hashRecord(const uint64_t& x) {
+    uint64_t z = x + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+struct Hasher {
+    uint64_t operator()(const uint64_t& x) const {
+        return hashRecord(x);
+    }
+};
+
+void report(const char* name, chrono::steady_clock::time_point begin, uint64_t check) {
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    cout << name << ": " << ITEM_SIZE / sec / 1e6 << " M items/s (checksum " << check << ")" << endl;
+}
+
+int main() {
+    ThreadPool pool;
+    pool.setTaskQueMaxThreshHold(ITEM_SIZE);
+    pool.start(2);
+
+    uint64_t expect = 0;
+    for(uint64_t i = 0; i < ITEM_SIZE; i++) {
+        expect ^= hashRecord(i);
+    }
+    bool ok = true;
+
+    {
+        auto begin = chrono::steady_clock::now();
+        vector<future<uint64_t>> results;
+        results.reserve(ITEM_SIZE);
+        for(uint64_t i = 0; i < ITEM_SIZE; i++) {
+            results.push_back(pool.submitTask(hashRecord, i));
+        }
+        uint64_t check = 0;
+        for(auto& f : results) {
+            check ^= f.get();
+        }
+        report("submitTask per item", begin, check);
+        ok = check == expect && ok;
+    }
+
+    for(size_t batchSize : {64, 1024}) {
+        auto begin = chrono::steady_clock::now();
+        BatchExecutor<uint64_t, uint64_t, Hasher> executor(pool, Hasher(), batchSize);
+        vector<BatchResult<uint64_t>> results;
+        results.reserve(ITEM_SIZE);
+        for(uint64_t i = 0; i < ITEM_SIZE; i++) {
+            results.push_back(executor.submit(i));
+        }
+        executor.flush();
+        uint64_t check = 0;
+        for(auto& r : results) {
+            check ^= r.get();
+        }
+        string name = "BatchExecutor batch " + to_string(batchSize);
+        report(name.c_str(), begin, check);
+        ok = check == expect && ok;
+    }
+
+    //linger：凑不满一批的数据在超时之后也会被处理
+    BatchExecutor<uint64_t, uint64_t, Hasher> executor(pool, Hasher(), 1024, chrono::microseconds(500));
+    BatchResult<uint64_t> r = executor.submit(1);
+    //没有flush，1s之内结果没有就绪说明linger没有生效
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(1);
+    while(!r.isReady() && chrono::steady_clock::now() < deadline) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    bool lingerOk = r.isReady() && r.get() == hashRecord(1);
+    cout << "linger flush: " << (lingerOk ? "ok" : "WRONG") << endl;
+    ok = lingerOk && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <future>
+#include <vector>
+#include <mutex>
+#include "threadpoolfinal.h"
+using namespace std;
+
+/*
+带截止时间的任务：
+1、submitTaskUntil(deadline, func, args...) 提交任务，deadline之前没有开始执行的任务会被丢弃
+   future.get()抛出TaskTimeoutError
+2、QUEUE_EDF模式下，截止时间最早的任务先执行
+3、任务队列满时先清理过期的任务，过期任务不会挤掉新提交的任务
+4、submitTaskWith(options, func, args...) 同时指定任务组、截止时间和字节数
+5、所有线程都在忙时，排队的任务到了截止时间future就抛出TaskTimeoutError，不用等到有线程空闲
+*/
+mutex orderMtx;
+vector<int> order; //任务的执行顺序
+
+int work(int id, int ms) {
+    {
+        lock_guard<mutex> lock(orderMtx);
+        order.push_back(id);
+    }
+    this_thread::sleep_for(chrono::milliseconds(ms));
+    return id;
+}
+
+//返回任务的结果，超时返回-1
+template<typename T>
+T show(const char* name, future<T>& f) {
+    try {
+        T val = f.get();
+        cout << name << " = " << val << endl;
+        return val;
+    }
+    catch(const TaskTimeoutError& e) {
+        cout << name << " : " << e.what() << endl;
+        return -1;
+    }
+}
+
+bool check(bool ok, const char* what) {
+    if(!ok) {
+        cout << "FAILED: " << what << endl;
+    }
+    return ok;
+}
+
+bool testEdf() {
+    ThreadPool pool;
+    pool.setQueueMode(QueueMode::QUEUE_EDF);
+    pool.setTaskQueMaxThreshHold(1024);
+    pool.start(1);
+
+    auto now = ThreadPool::Clock::now();
+    //先占住唯一的线程500ms
+    future<int> r0 = pool.submitTask(work, 0, 500);
+    this_thread::sleep_for(chrono::milliseconds(50));
+    //截止时间晚的先提交，EDF模式下会后执行
+    future<int> r1 = pool.submitTaskUntil(now + chrono::seconds(5), work, 1, 100);
+    future<int> r2 = pool.submitTaskUntil(now + chrono::seconds(2), work, 2, 100);
+    //线程被占用期间截止时间就过了，不会执行
+    future<int> r3 = pool.submitTaskUntil(now + chrono::milliseconds(200), work, 3, 100);
+    //没有截止时间的任务排在最后
+    future<int> r4 = pool.submitTask(work, 4, 100);
+
+    bool ok = true;
+    ok = check(show("r0", r0) == 0, "r0") && ok;
+    ok = check(show("r1", r1) == 1, "r1") && ok;
+    ok = check(show("r2", r2) == 2, "r2") && ok;
+    ok = check(show("r3", r3) == -1, "r3 should expire") && ok;
+    ok = check(show("r4", r4) == 4, "r4") && ok;
+    ok = check(order == vector<int>({0, 2, 1, 4}), "EDF order should be 0 2 1 4") && ok;
+    ok = check(pool.getExpiredTaskSize() == 1, "expired tasks should be 1") && ok;
+    cout << "expired tasks: " << pool.getExpiredTaskSize() << endl;
+    return ok;
+}
+
+//队列上限2，唯一的线程在忙，队列里面两个已经过期的任务不能让新任务提交失败
+bool testExpiredDoNotBlock(QueueMode mode) {
+    ThreadPool pool;
+    pool.setQueueMode(mode);
+    pool.setTaskQueMaxThreshHold(2);
+    pool.setTaskSubmitTimeout(chrono::milliseconds(0));
+    pool.start(1);
+
+    future<int> busy = pool.submitTask(work, 10, 200);
+    this_thread::sleep_for(chrono::milliseconds(50));
+    future<int> e1 = pool.submitTaskUntil(ThreadPool::Clock::now(), work, 11, 0);
+    future<int> e2 = pool.submitTaskUntil(ThreadPool::Clock::now(), work, 12, 0);
+    future<int> live = pool.submitTask([]() {return 42;});
+
+    bool ok = true;
+    ok = check(show("live", live) == 42, "live task rejected by expired tasks") && ok;
+    ok = check(show("e1", e1) == -1 && show("e2", e2) == -1, "e1/e2 should expire") && ok;
+    ok = check(pool.getExpiredTaskSize() == 2, "expired tasks should be 2") && ok;
+    busy.get();
+    return ok;
+}
+
+//任务组、截止时间和字节数组合使用：组内并发上限1，组内第二个任务排队时超过截止时间
+bool testOptions() {
+    ThreadPool pool;
+    pool.start(2);
+    int group = pool.createGroup("limited", 1, 1);
+
+    TaskOptions options;
+    options.group = group;
+    options.bytes = 4096;
+    future<int> busy = pool.submitTaskWith(options, work, 20, 200);
+    this_thread::sleep_for(chrono::milliseconds(50));
+    bool ok = check(pool.getInFlightBytes() == 4096, "in flight bytes should be 4096");
+
+    options.deadline = ThreadPool::Clock::now() + chrono::milliseconds(50);
+    future<int> late = pool.submitTaskWith(options, work, 21, 0);
+    ok = check(pool.getQueuedBytes() == 4096, "queued bytes should be 4096") && ok;
+    ok = check(show("busy", busy) == 20, "busy") && ok;
+    ok = check(show("late", late) == -1, "late should expire") && ok;
+    ok = check(pool.getExpiredTaskSize() == 1, "expired tasks should be 1") && ok;
+    ok = check(pool.getGroupStats(group).submitted == 2, "group should have 2 tasks") && ok;
+    return ok;
+}
+
+bool testExpireWhileBusy() {
+    ThreadPool pool;
+    pool.start(2);
+    future<int> busy1 = pool.submitTask(work, 30, 1000);
+    future<int> busy2 = pool.submitTask(work, 31, 1000);
+    this_thread::sleep_for(chrono::milliseconds(50));
+    auto begin = ThreadPool::Clock::now();
+    future<int> late = pool.submitTaskUntil(begin + chrono::milliseconds(50), work, 32, 0);
+    int val = show("late", late);
+    auto ms = chrono::duration_cast<chrono::milliseconds>(ThreadPool::Clock::now() - begin).count();
+    cout << "deadline 50 ms, failed after " << ms << " ms" << endl;
+    bool ok = check(val == -1, "late should expire");
+    ok = check(ms < 300, "late should fail near its deadline") && ok;
+    ok = check(pool.getExpiredTaskSize() == 1, "expired tasks should be 1") && ok;
+    busy1.get();
+    busy2.get();
+    return ok;
+}
+
+int main() {
+    bool ok = testEdf();
+    ok = testExpiredDoNotBlock(QueueMode::QUEUE_FIFO) && ok;
+    ok = testExpiredDoNotBlock(QueueMode::QUEUE_EDF) && ok;
+    ok = testOptions() && ok;
+    ok = testExpireWhileBusy() && ok;
+    cout << (ok ? "all checks passed" : "some checks FAILED") << endl;
+    return ok ? 0 : 1;
+}
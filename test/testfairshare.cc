@@ -0,0 +1,96 @@
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <future>
+#include <algorithm>
+#include "threadpoolfinal.h"
+using namespace std;
+
+/*
+多个租户共用一个线程池：
+flood租户不停地提交大量任务，interactive租户每隔5ms提交一个任务
+1、所有任务都在默认任务组(FIFO)：interactive的任务排在flood的大量任务后面
+2、两个租户各自一个任务组：按DRR轮流调度，interactive的延迟不受flood影响
+interactive的p99延迟没有比单个FIFO低一个数量级，或者limited组同时执行超过1个任务，返回非0
+*/
+const int FLOOD_SIZE = 20000;
+const int INTERACTIVE_SIZE = 100;
+
+//忙等模拟计算任务
+void spin(int us) {
+    auto end = chrono::steady_clock::now() + chrono::microseconds(us);
+    while(chrono::steady_clock::now() < end) {}
+}
+
+//返回interactive任务的p99延迟(us)
+double run(const char* name, bool useGroups) {
+    ThreadPool pool;
+    pool.setTaskQueMaxThreshHold(FLOOD_SIZE);
+    pool.start(2);
+    int floodGroup = useGroups ? pool.createGroup("flood", 1) : 0;
+    int interactiveGroup = useGroups ? pool.createGroup("interactive", 1) : 0;
+
+    atomic_bool stop(false);
+    thread flooder([&]() {
+        for(int i = 0; i < FLOOD_SIZE && !stop; i++) {
+            pool.submitTaskTo(floodGroup, spin, 50);
+        }
+    });
+
+    //interactive任务记录从提交到开始执行的延迟
+    vector<double> latency;
+    for(int i = 0; i < INTERACTIVE_SIZE; i++) {
+        auto submitTime = chrono::steady_clock::now();
+        future<double> f = pool.submitTaskTo(interactiveGroup, [submitTime]() {
+            return chrono::duration<double, micro>(chrono::steady_clock::now() - submitTime).count();
+        });
+        latency.push_back(f.get());
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+    stop = true;
+    flooder.join();
+
+    sort(latency.begin(), latency.end());
+    double p99 = latency[latency.size() * 99 / 100];
+    cout << name << ": interactive latency p50 " << latency[latency.size() / 2] / 1000
+         << " ms, p99 " << p99 / 1000 << " ms" << endl;
+    for(int g : {floodGroup, interactiveGroup}) {
+        GroupStats stats = pool.getGroupStats(g);
+        cout << "  group " << stats.name << ": queued " << stats.queued << ", submitted " << stats.submitted
+             << ", completed " << stats.completed << ", avg wait " << stats.avgWaitUs / 1000
+             << " ms, max wait " << stats.maxWaitUs / 1000 << " ms" << endl;
+        if(!useGroups) {
+            break;
+        }
+    }
+    return p99;
+}
+
+int main() {
+    double fifoP99 = run("single FIFO", false);
+    double fairP99 = run("fair share ", true);
+    bool ok = fairP99 * 10 < fifoP99;
+
+    //并发上限：limited组最多同时执行1个任务
+    ThreadPool pool;
+    pool.setTaskQueMaxThreshHold(1024);
+    pool.start(4);
+    int limited = pool.createGroup("limited", 1, 1);
+    atomic_int running(0), peak(0);
+    vector<future<void>> results;
+    for(int i = 0; i < 20; i++) {
+        results.push_back(pool.submitTaskTo(limited, [&]() {
+            int cur = ++running;
+            int old = peak;
+            while(cur > old && !peak.compare_exchange_weak(old, cur)) {}
+            this_thread::sleep_for(chrono::milliseconds(5));
+            running--;
+        }));
+    }
+    for(auto& f : results) {
+        f.get();
+    }
+    cout << "limited group peak concurrency: " << peak << " (cap 1)" << endl;
+    ok = peak <= 1 && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <future>
+#include <ctime>
+#include "fiber.h"
+using namespace std;
+
+/*
+协程：
+1、this_fiber::yield()的切换开销，和两个线程通过条件变量来回切换比较
+2、FiberMutex保护的计数器
+3、大量同时sleep的任务：协程只需要几个线程，普通任务在cached模式下每个任务占一个线程
+4、大量协程await还没有完成的FiberFuture：挂起期间不占用CPU，结果设置后全部被唤醒
+*/
+const int SWITCH_ROUNDS = 100000;
+
+long vmRSS() {
+    ifstream in("/proc/self/status");
+    string line;
+    while(getline(in, line)) {
+        if(line.compare(0, 6, "VmRSS:") == 0) {
+            return stol(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+double elapsedMs(chrono::steady_clock::time_point begin) {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count() / 1000.0;
+}
+
+void fiberSwitch() {
+    ThreadPool pool;
+    pool.start(1);
+    auto begin = chrono::steady_clock::now();
+    submitFiber(pool, []() {
+        for(int i = 0; i < SWITCH_ROUNDS; i++) {
+            this_fiber::yield();
+        }
+    }).get();
+    cout << "fiber yield: " << elapsedMs(begin) * 1e6 / SWITCH_ROUNDS << " ns/switch" << endl;
+}
+
+void threadSwitch() {
+    mutex mtx;
+    condition_variable cond;
+    bool ping = true;
+    auto begin = chrono::steady_clock::now();
+    thread other([&]() {
+        for(int i = 0; i < SWITCH_ROUNDS; i++) {
+            unique_lock<mutex> lock(mtx);
+            cond.wait(lock, [&]() {return !ping;});
+            ping = true;
+            cond.notify_one();
+        }
+    });
+    for(int i = 0; i < SWITCH_ROUNDS; i++) {
+        unique_lock<mutex> lock(mtx);
+        cond.wait(lock, [&]() {return ping;});
+        ping = false;
+        cond.notify_one();
+    }
+    other.join();
+    //每一轮是两次切换
+    cout << "thread condvar ping-pong: " << elapsedMs(begin) * 1e6 / (2 * SWITCH_ROUNDS) << " ns/switch" << endl;
+}
+
+//检查计数器，有协程在没有拿到锁的时候进入临界区会少计数
+bool fiberMutex() {
+    ThreadPool pool;
+    pool.start(2);
+    FiberMutex mtx;
+    int counter = 0;
+    vector<FiberFuture<void>> results;
+    for(int i = 0; i < 100; i++) {
+        results.push_back(submitFiber(pool, [&]() {
+            for(int j = 0; j < 1000; j++) {
+                lock_guard<FiberMutex> lock(mtx);
+                counter++;
+                if(j % 100 == 0) {
+                    this_fiber::yield(); //持有锁的时候让出，其他协程在锁上挂起
+                }
+            }
+        }));
+    }
+    for(auto& f : results) {
+        f.get();
+    }
+    cout << "FiberMutex counter: " << counter << " (expect 100000)" << endl;
+    return counter == 100000;
+}
+
+//检查每个协程返回的id
+bool blockedFibers(int count) {
+    ThreadPool pool;
+    pool.start(2);
+    long rss = vmRSS();
+    auto begin = chrono::steady_clock::now();
+    vector<FiberFuture<int>> results;
+    for(int i = 0; i < count; i++) {
+        results.push_back(submitFiber(pool, [](int id) {
+            this_fiber::sleep_for(chrono::milliseconds(200));
+            return id;
+        }, i));
+    }
+    long peak = vmRSS();
+    bool ok = true;
+    for(int i = 0; i < count; i++) {
+        ok = results[i].get() == i && ok;
+    }
+    cout << count << " sleeping fibers on 2 threads: " << elapsedMs(begin) << " ms, RSS +" << peak - rss
+         << " kB, results " << (ok ? "ok" : "WRONG") << endl;
+    return ok;
+}
+
+void blockedThreads(int count) {
+    ThreadPool pool;
+    pool.setMode(PoolMode::MODE_CACHED);
+    pool.setTaskQueMaxThreshHold(count);
+    pool.start(2);
+    long rss = vmRSS();
+    long peak = rss;
+    auto begin = chrono::steady_clock::now();
+    vector<future<int>> results;
+    for(int i = 0; i < count; i++) {
+        results.push_back(pool.submitTask([](int id) {
+            this_thread::sleep_for(chrono::milliseconds(200));
+            return id;
+        }, i));
+        peak = max(peak, vmRSS());
+    }
+    for(auto& f : results) {
+        f.get();
+    }
+    cout << count << " sleeping tasks on cached pool (max " << THREAD_MAX_THRESHHOLD << " threads): "
+         << elapsedMs(begin) << " ms, RSS +" << peak - rss << " kB" << endl;
+}
+
+//count个协程等待还没有设置的FiberPromise，500ms后设置结果，检查结果和等待期间的CPU时间
+bool awaitFibers(int count) {
+    ThreadPool pool;
+    pool.start(2);
+    vector<FiberPromise<int>> promises(count);
+    vector<FiberFuture<int>> results;
+    for(int i = 0; i < count; i++) {
+        FiberFuture<int> input = promises[i].getFuture();
+        results.push_back(submitFiber(pool, [](FiberFuture<int> input) {
+            return this_fiber::await(input) + 1;
+        }, std::move(input)));
+    }
+    this_thread::sleep_for(chrono::milliseconds(50)); //等所有协程挂起
+    clock_t cpu = clock();
+    this_thread::sleep_for(chrono::milliseconds(500));
+    double cpuMs = (clock() - cpu) * 1000.0 / CLOCKS_PER_SEC;
+    for(int i = 0; i < count; i++) {
+        promises[i].setValue(i);
+    }
+    bool ok = true;
+    for(int i = 0; i < count; i++) {
+        ok = results[i].get() == i + 1 && ok;
+    }
+    cout << count << " fibers awaiting for 500 ms: CPU " << cpuMs << " ms, results " << (ok ? "ok" : "WRONG") << endl;
+    return ok && cpuMs < 100;
+}
+
+int main() {
+    fiberSwitch();
+    threadSwitch();
+    bool ok = fiberMutex();
+    ok = blockedFibers(10000) && ok;
+    blockedThreads(1000);
+    ok = awaitFibers(2000) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+#include <iostream>
+#include <vector>
+#include <future>
+#include <atomic>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <random>
+#include "parallelalgorithm.h"
+using namespace std;
+
+/*
+全局线程池：
+1、第一次使用ThreadPool::global()时才创建线程，比较第一次提交和之后提交的延迟
+2、父进程的全局线程池满负载时fork，子进程里面的全局线程池重新创建工作线程，可以继续提交任务
+3、在全局线程池的任务里面fork，子进程里面调用fork的工作线程继续执行完这个任务，线程池的计数保持正确
+4、子进程里面第一次使用全局线程池就是并行算法时，并行算法也能重新创建工作线程并行执行
+*/
+const int FORK_SIZE = 8;
+const int CHILD_TASK_SIZE = 1000;
+
+long long work(int n) {
+    long long sum = 0;
+    for(int i = 0; i < n; i++) {
+        sum += i % 7;
+    }
+    return sum;
+}
+
+long long expect(int n) {
+    return work(n);
+}
+
+//子进程：提交任务并检查结果，通过退出码告诉父进程
+int runChild() {
+    //第一次使用全局线程池的是并行算法，帮手任务要触发重新创建工作线程
+    vector<int> v(200001);
+    mt19937 rng(1);
+    for(auto& x : v) {
+        x = (int)rng();
+    }
+    parallelSort(ThreadPool::global(), v.begin(), v.end());
+    if(!is_sorted(v.begin(), v.end()) || ThreadPool::global().getThreadSize() == 0) {
+        return 4;
+    }
+    vector<future<long long>> results;
+    for(int i = 0; i < CHILD_TASK_SIZE; i++) {
+        results.push_back(ThreadPool::global().submitTask(work, i));
+    }
+    for(int i = 0; i < CHILD_TASK_SIZE; i++) {
+        if(results[i].get() != expect(i)) {
+            return 1;
+        }
+    }
+    //定时器也要能在子进程里面触发
+    promise<void> fired;
+    ThreadPool::global().runAfter(chrono::milliseconds(1), [&fired]() {fired.set_value();});
+    if(fired.get_future().wait_for(chrono::seconds(5)) != future_status::ready) {
+        return 2;
+    }
+    return 0;
+}
+
+//在任务里面fork，子进程等这个任务执行完再检查线程池的状态，返回子进程的退出码
+int forkInTask() {
+    future<int> f = ThreadPool::global().submitTask([]() -> int {
+        pid_t pid = fork();
+        if(pid == 0) {
+            //子进程里面只有当前这个工作线程，另起一个线程等任务返回
+            thread([]() {
+                this_thread::sleep_for(chrono::milliseconds(50));
+                ThreadPool& pool = ThreadPool::global();
+                if(pool.getInFlightBytes() != 0 || pool.getGroupStats(0).running != 0) {
+                    _exit(3);
+                }
+                _exit(runChild());
+            }).detach();
+            return 0;
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    });
+    return f.get();
+}
+
+int main() {
+    auto begin = chrono::steady_clock::now();
+    ThreadPool::global().submitTask([]() {return 0;}).get();
+    auto first = chrono::steady_clock::now() - begin;
+    begin = chrono::steady_clock::now();
+    ThreadPool::global().submitTask([]() {return 0;}).get();
+    auto second = chrono::steady_clock::now() - begin;
+    cout << "first submit (create pool): " << chrono::duration_cast<chrono::microseconds>(first).count()
+         << " us, second submit: " << chrono::duration_cast<chrono::microseconds>(second).count() << " us" << endl;
+
+    //父进程的全局线程池一直有任务在执行和排队
+    atomic<bool> stop(false);
+    vector<future<long long>> load;
+    thread producer([&]() {
+        int i = 0;
+        while(!stop) {
+            load.push_back(ThreadPool::global().submitTask(work, 100000 + i % 100));
+            i++;
+            if(load.size() % 512 == 0) {
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        }
+    });
+
+    int failed = 0;
+    for(int i = 0; i < FORK_SIZE; i++) {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        pid_t pid = fork();
+        if(pid == 0) {
+            //子进程不能执行父进程的析构和atexit，直接_exit
+            _exit(runChild());
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            cout << "child " << i << " failed, status " << status << endl;
+            failed++;
+        }
+    }
+    stop = true;
+    producer.join();
+
+    int ret = forkInTask();
+    if(ret != 0) {
+        cout << "fork in task failed, child status " << ret << endl;
+        failed++;
+    }
+
+    //父进程的任务不受fork影响
+    for(size_t i = 0; i < load.size(); i++) {
+        if(load[i].get() != expect(100000 + i % 100)) {
+            cout << "parent task " << i << " wrong result" << endl;
+            failed++;
+            break;
+        }
+    }
+    cout << "forks: " << FORK_SIZE << ", failed children: " << failed
+         << ", parent tasks: " << load.size() << endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <vector>
+#include <future>
+#include <atomic>
+#include <random>
+#include "threadpoolfinal.h"
+using namespace std;
+
+/*
+任务携带的数据大小差别很大：90%是1KB，10%是1MB
+1、只按任务数量限制(64个)：排队的数据量取决于碰巧排进来多少个大任务
+2、按字节数限制(8MB)：排队和执行中的数据量始终不超过预算
+比较占用内存的峰值和吞吐量
+字节预算下峰值超过预算加一个执行中的大任务，或者所有任务完成之后字节数没有归0，返回非0
+*/
+const int TASK_SIZE = 2000;
+const size_t LARGE_SIZE = 1024 * 1024;
+
+atomic<size_t> peakBytes(0);
+
+size_t process(const vector<char>& payload, ThreadPool* pool) {
+    size_t used = pool -> getQueuedBytes() + pool -> getInFlightBytes();
+    size_t old = peakBytes;
+    while(used > old && !peakBytes.compare_exchange_weak(old, used)) {}
+    size_t sum = 0;
+    for(size_t i = 0; i < payload.size(); i += 64) {
+        sum += payload[i];
+    }
+    this_thread::sleep_for(chrono::microseconds(payload.size() / 1024 * 10));
+    return sum;
+}
+
+bool run(const char* name, int maxTasks, size_t maxBytes) {
+    peakBytes = 0;
+    ThreadPool pool;
+    pool.setTaskQueMaxThreshHold(maxTasks);
+    pool.setTaskQueMaxBytes(maxBytes);
+    pool.setTaskSubmitTimeout(chrono::seconds(10));
+    pool.start(4);
+
+    mt19937 rng(1);
+    auto begin = chrono::steady_clock::now();
+    vector<future<size_t>> results;
+    size_t totalBytes = 0;
+    for(int i = 0; i < TASK_SIZE; i++) {
+        size_t size = rng() % 10 == 0 ? LARGE_SIZE : 1024;
+        totalBytes += size;
+        //vector参数按capacity自动估算字节数
+        results.push_back(pool.submitTask(process, vector<char>(size, 1), &pool));
+    }
+    for(auto& f : results) {
+        f.get();
+    }
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    cout << name << ": " << TASK_SIZE / sec << " tasks/s, " << totalBytes / sec / (1 << 20)
+         << " MB/s, peak queued+in-flight " << peakBytes / 1024 << " kB" << endl;
+    bool ok = true;
+    if(maxBytes > 0) {
+        //和submitTask按参数估算的字节数一致
+        size_t largest = taskPayloadSize(&process) + taskPayloadSize(vector<char>(LARGE_SIZE)) + taskPayloadSize(&pool);
+        ok = peakBytes <= maxBytes + largest;
+    }
+    //future就绪之后工作线程才归还执行中的字节数，最多等1s
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(1);
+    while((pool.getQueuedBytes() != 0 || pool.getInFlightBytes() != 0) && chrono::steady_clock::now() < deadline) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    if(pool.getQueuedBytes() != 0 || pool.getInFlightBytes() != 0) {
+        cout << "  bytes left after all tasks: queued " << pool.getQueuedBytes()
+             << ", in-flight " << pool.getInFlightBytes() << endl;
+        ok = false;
+    }
+    return ok;
+}
+
+int main() {
+    bool ok = run("count limit 64   ", 64, 0);
+    ok = run("byte budget 8MB  ", TASK_SIZE, 8 << 20) && ok;
+
+    //声明字节数：超过预算的大任务在没有其他任务时也能提交
+    ThreadPool pool;
+    pool.setTaskQueMaxBytes(1024);
+    pool.start(1);
+    future<int> r = pool.submitTaskSized(1 << 20, []() {return 1;});
+    cout << "oversized task: " << r.get() << ", bytes after: " << pool.getQueuedBytes() << endl;
+    return ok ? 0 : 1;
+}
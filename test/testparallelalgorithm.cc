@@ -0,0 +1,182 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <numeric>
+#ifdef THREADPOOL_HAVE_PSTL
+#include <execution>
+#endif
+#include "parallelalgorithm.h"
+using namespace std;
+
+/*
+并行算法和串行STL(以及std::execution::par)的对比，检查结果是否一致
+用法：testparallelalgorithm [元素个数 ...]，默认10^6和10^7
+线程池固定4个线程，单核机器上也会走并行的代码路径
+*/
+const int TEST_THREAD_SIZE = 4;
+
+template<typename Func>
+double timeMs(Func func) {
+    auto begin = chrono::steady_clock::now();
+    func();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+}
+
+void report(const char* name, double serial, double pool, double par, bool ok) {
+    cout << "  " << name << ": serial " << serial << " ms, pool " << pool << " ms";
+    if(par >= 0) {
+        cout << ", std::execution::par " << par << " ms";
+    }
+    cout << (ok ? "" : "  MISMATCH") << endl;
+}
+
+bool run(ThreadPool& pool, size_t n) {
+    cout << "n = " << n << endl;
+    bool allOk = true;
+    mt19937_64 rng(n);
+    vector<uint64_t> input(n);
+    for(auto& x : input) {
+        x = rng();
+    }
+    double par = -1;
+
+    {
+        vector<uint64_t> a = input, b = input;
+        double serial = timeMs([&]() {sort(a.begin(), a.end());});
+        double p = timeMs([&]() {parallelSort(pool, b.begin(), b.end());});
+#ifdef THREADPOOL_HAVE_PSTL
+        vector<uint64_t> c = input;
+        par = timeMs([&]() {sort(execution::par, c.begin(), c.end());});
+#endif
+        bool ok = a == b;
+        allOk = allOk && ok;
+        report("sort          ", serial, p, par, ok);
+    }
+
+    {
+        vector<uint64_t> a(n), b(n);
+        double serial = timeMs([&]() {inclusive_scan(input.begin(), input.end(), a.begin());});
+        double p = timeMs([&]() {parallelInclusiveScan(pool, input.begin(), input.end(), b.begin());});
+#ifdef THREADPOOL_HAVE_PSTL
+        vector<uint64_t> c(n);
+        par = timeMs([&]() {inclusive_scan(execution::par, input.begin(), input.end(), c.begin());});
+#endif
+        bool ok = a == b;
+        allOk = allOk && ok;
+        report("inclusive_scan", serial, p, par, ok);
+    }
+
+    {
+        vector<uint64_t> a(n), b(n);
+        double serial = timeMs([&]() {exclusive_scan(input.begin(), input.end(), a.begin(), uint64_t(7));});
+        double p = timeMs([&]() {parallelExclusiveScan(pool, input.begin(), input.end(), b.begin(), uint64_t(7));});
+#ifdef THREADPOOL_HAVE_PSTL
+        vector<uint64_t> c(n);
+        par = timeMs([&]() {exclusive_scan(execution::par, input.begin(), input.end(), c.begin(), uint64_t(7));});
+#endif
+        bool ok = a == b;
+        allOk = allOk && ok;
+        report("exclusive_scan", serial, p, par, ok);
+    }
+
+    {
+        auto square = [](uint64_t x) -> uint64_t {return (x & 0xFFFF) * (x & 0xFFFF);};
+        uint64_t a = 0, b = 0;
+        double serial = timeMs([&]() {a = transform_reduce(input.begin(), input.end(), uint64_t(0), plus<uint64_t>(), square);});
+        double p = timeMs([&]() {b = parallelTransformReduce(pool, input.begin(), input.end(), uint64_t(0), plus<uint64_t>(), square);});
+#ifdef THREADPOOL_HAVE_PSTL
+        par = timeMs([&]() {transform_reduce(execution::par, input.begin(), input.end(), uint64_t(0), plus<uint64_t>(), square);});
+#endif
+        bool ok = a == b;
+        allOk = allOk && ok;
+        report("transform_reduce", serial, p, par, ok);
+    }
+
+    {
+        auto update = [](uint64_t& x) {x = x * 2 + 1;};
+        vector<uint64_t> a = input, b = input;
+        double serial = timeMs([&]() {for_each(a.begin(), a.end(), update);});
+        double p = timeMs([&]() {parallelForEach(pool, b.begin(), b.end(), update);});
+#ifdef THREADPOOL_HAVE_PSTL
+        vector<uint64_t> c = input;
+        par = timeMs([&]() {for_each(execution::par, c.begin(), c.end(), update);});
+#endif
+        bool ok = a == b;
+        allOk = allOk && ok;
+        report("for_each      ", serial, p, par, ok);
+    }
+
+    {
+        auto even = [](uint64_t x) -> bool {return (x & 1) == 0;};
+        vector<uint64_t> a(n), b(n);
+        size_t sizeA = 0, sizeB = 0;
+        double serial = timeMs([&]() {sizeA = copy_if(input.begin(), input.end(), a.begin(), even) - a.begin();});
+        double p = timeMs([&]() {sizeB = parallelCopyIf(pool, input.begin(), input.end(), b.begin(), even) - b.begin();});
+#ifdef THREADPOOL_HAVE_PSTL
+        vector<uint64_t> c(n);
+        par = timeMs([&]() {copy_if(execution::par, input.begin(), input.end(), c.begin(), even);});
+#endif
+        bool ok = sizeA == sizeB && equal(a.begin(), a.begin() + sizeA, b.begin());
+        allOk = allOk && ok;
+        report("copy_if       ", serial, p, par, ok);
+    }
+    return allOk;
+}
+
+int main(int argc, char** argv) {
+    vector<size_t> sizes;
+    for(int i = 1; i < argc; i++) {
+        sizes.push_back(strtoull(argv[i], nullptr, 10));
+    }
+    if(sizes.empty()) {
+        sizes = {1000000, 10000000};
+    }
+
+    ThreadPool pool;
+    pool.start(TEST_THREAD_SIZE);
+    cout << "hardware threads: " << thread::hardware_concurrency() << ", pool threads: " << pool.getThreadSize() << endl;
+
+    //小数据和边界情况
+    bool ok = true;
+    for(size_t n : {0, 1, 5, 1023, 1024, 1025, 200001}) {
+        vector<int> v(n);
+        iota(v.rbegin(), v.rend(), 0);
+        parallelSort(pool, v.begin(), v.end());
+        ok = ok && is_sorted(v.begin(), v.end());
+        vector<int> s(n);
+        parallelInclusiveScan(pool, v.begin(), v.end(), s.begin());
+        ok = ok && (n == 0 || s.back() == (int)(n * (n - 1) / 2));
+    }
+    //copy_if和exclusive_scan在多个数据块上和STL的结果比较
+    for(size_t n : {0, 1, 1025, 200001}) {
+        mt19937 rng(n);
+        vector<unsigned> v(n);
+        for(auto& x : v) {
+            x = rng() % 1000;
+        }
+        auto odd = [](unsigned x) -> bool {return x & 1;};
+        vector<unsigned> a(n), b(n);
+        size_t sizeA = copy_if(v.begin(), v.end(), a.begin(), odd) - a.begin();
+        size_t sizeB = parallelCopyIf(pool, v.begin(), v.end(), b.begin(), odd) - b.begin();
+        ok = ok && sizeA == sizeB && equal(a.begin(), a.begin() + sizeA, b.begin());
+        exclusive_scan(v.begin(), v.end(), a.begin(), 5u);
+        parallelExclusiveScan(pool, v.begin(), v.end(), b.begin(), 5u);
+        ok = ok && a == b;
+    }
+    //异常传回调用线程
+    try {
+        vector<int> v(1 << 20);
+        parallelForEach(pool, v.begin(), v.end(), [](int&) {throw runtime_error("stop");});
+        ok = false;
+    }
+    catch(const runtime_error&) {}
+    cout << "edge cases: " << (ok ? "ok" : "FAILED") << endl;
+
+    for(size_t n : sizes) {
+        ok = run(pool, n) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <future>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "threadpoolfinal.h"
+using namespace std;
+
+/*
+I/O密集型任务的两种写法：
+1、MODE_CACHED：每个任务在线程里面阻塞read()，需要多少连接就要多少线程
+2、watchFd：fd就绪后回调才作为任务执行，少量线程就能处理所有连接
+一个生产者线程轮流往每个管道写数据，比较吞吐量和进程的线程数量
+另外检查N个线程同时执行N个阻塞任务：一个空闲线程在epoll_wait上，连续提交时它也要被唤醒
+回调(watchFd、runAfter、execute)抛出异常时进程不能退出，异常被计数丢弃
+*/
+const int PIPE_SIZE = 64;   //连接数量
+const int ROUNDS = 200;     //每个连接上的消息数量
+
+//读取/proc/self/status中的线程数量
+int threadCount() {
+    ifstream in("/proc/self/status");
+    string line;
+    while(getline(in, line)) {
+        if(line.compare(0, 8, "Threads:") == 0) {
+            return stoi(line.substr(8));
+        }
+    }
+    return 0;
+}
+
+struct Pipes {
+    Pipes() {
+        for(int i = 0; i < PIPE_SIZE; i++) {
+            int fds[2];
+            ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+            rfd.push_back(fds[0]);
+            wfd.push_back(fds[1]);
+        }
+    }
+    ~Pipes() {
+        for(int i = 0; i < PIPE_SIZE; i++) {
+            ::close(rfd[i]);
+            ::close(wfd[i]);
+        }
+    }
+    //生产者：每一轮给每个连接写一个字节，直到所有消息都被消费
+    void produce(atomic_int& received) {
+        char c = 'x';
+        for(int r = 0; r < ROUNDS; r++) {
+            for(int i = 0; i < PIPE_SIZE; i++) {
+                ::write(wfd[i], &c, 1);
+            }
+            //等消费者跟上，模拟请求-响应式的连接
+            while(received < (r + 1) * PIPE_SIZE) {
+                this_thread::yield();
+            }
+        }
+    }
+    vector<int> rfd;
+    vector<int> wfd;
+};
+
+void report(const char* name, chrono::steady_clock::time_point begin, int peakThreads) {
+    auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+    cout << name << ": " << PIPE_SIZE * ROUNDS << " msgs in " << us / 1000.0 << " ms, "
+         << PIPE_SIZE * ROUNDS * 1e6 / us << " msgs/s, peak threads " << peakThreads << endl;
+}
+
+void blockingRead() {
+    Pipes pipes;
+    atomic_int received(0);
+    int peak = 0;
+    auto begin = chrono::steady_clock::now();
+    {
+        ThreadPool pool;
+        pool.setMode(PoolMode::MODE_CACHED);
+        pool.setTaskQueMaxThreshHold(1024);
+        pool.start(2);
+        vector<future<void>> results;
+        for(int i = 0; i < PIPE_SIZE; i++) {
+            int fd = pipes.rfd[i];
+            results.push_back(pool.submitTask([fd, &received]() {
+                char c;
+                for(int r = 0; r < ROUNDS; r++) {
+                    ::read(fd, &c, 1);
+                    received++;
+                }
+            }));
+        }
+        thread producer([&]() {pipes.produce(received);});
+        peak = threadCount();
+        for(auto& f : results) {
+            f.get();
+            peak = max(peak, threadCount());
+        }
+        producer.join();
+        report("cached blocking read", begin, peak);
+    }
+}
+
+void reactor() {
+    Pipes pipes;
+    atomic_int received(0);
+    int peak = 0;
+    auto begin = chrono::steady_clock::now();
+    {
+        ThreadPool pool;
+        pool.setTaskQueMaxThreshHold(1024);
+        pool.start(2);
+        promise<void> done;
+        //每个连接读ROUNDS次，回调里面读一个字节后重新注册
+        function<void(int, int)> arm = [&](int fd, int left) {
+            pool.watchFd(fd, EPOLLIN, [&, fd, left](uint32_t) {
+                char c;
+                ::read(fd, &c, 1);
+                if(++received == PIPE_SIZE * ROUNDS) {
+                    done.set_value();
+                }
+                if(left > 1) {
+                    arm(fd, left - 1);
+                }
+            });
+        };
+        for(int i = 0; i < PIPE_SIZE; i++) {
+            arm(pipes.rfd[i], ROUNDS);
+        }
+        thread producer([&]() {pipes.produce(received);});
+        peak = threadCount();
+        done.get_future().get();
+        producer.join();
+        peak = max(peak, threadCount());
+        report("fixed + watchFd     ", begin, peak);
+    }
+}
+
+//N个线程执行N个阻塞200ms的任务，每一轮应该只需要200ms左右
+bool parallelBlocking() {
+    const int n = 8;
+    ThreadPool pool;
+    pool.start(n);
+    this_thread::sleep_for(chrono::milliseconds(50)); //等所有线程进入等待
+    bool ok = true;
+    for(int round = 0; round < 10; round++) {
+        auto begin = chrono::steady_clock::now();
+        vector<future<void>> results;
+        for(int i = 0; i < n; i++) {
+            results.push_back(pool.submitTask([]() {this_thread::sleep_for(chrono::milliseconds(200));}));
+        }
+        for(auto& f : results) {
+            f.get();
+        }
+        auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+        cout << n << " blocking tasks on " << n << " threads: " << ms << " ms" << endl;
+        ok = ok && ms < 350;
+    }
+    return ok;
+}
+
+bool throwingCallbacks() {
+    ThreadPool pool;
+    pool.start(1);
+    int fds[2];
+    ::pipe(fds);
+    pool.watchFd(fds[0], EPOLLIN, [](uint32_t) {throw runtime_error("watchFd callback");});
+    ::write(fds[1], "a", 1);
+    pool.runAfter(chrono::milliseconds(1), []() {throw runtime_error("timer callback");});
+    pool.execute([]() {throw 1;});
+    this_thread::sleep_for(chrono::milliseconds(100));
+    //线程池还能正常执行任务
+    bool ok = pool.submitTask([]() {return 7;}).get() == 7 && pool.getFailedCallbackSize() == 3;
+    cout << "throwing callbacks: " << pool.getFailedCallbackSize() << " failed, pool " << (ok ? "ok" : "FAILED") << endl;
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return ok;
+}
+
+int main() {
+    bool ok = parallelBlocking();
+    ok = throwingCallbacks() && ok;
+    blockingRead();
+    reactor();
+
+    //asyncWait：等待一个fd可读
+    ThreadPool pool;
+    pool.start(1);
+    int fds[2];
+    ::pipe(fds);
+    future<uint32_t> ready = pool.asyncWait(fds[0], EPOLLIN);
+    ::write(fds[1], "a", 1);
+    cout << "asyncWait EPOLLIN: " << ((ready.get() & EPOLLIN) != 0) << endl;
+
+    //线程池没有启动时asyncWait返回ECANCELED
+    ThreadPool stopped;
+    future<uint32_t> canceled = stopped.asyncWait(fds[0], EPOLLIN);
+    bool canceledOk = false;
+    try {
+        canceled.get();
+    }
+    catch(const system_error& e) {
+        canceledOk = e.code().value() == ECANCELED;
+    }
+    cout << "asyncWait on stopped pool: " << (canceledOk ? "ECANCELED" : "FAILED") << endl;
+    ok = ok && canceledOk;
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return ok ? 0 : 1;
+}
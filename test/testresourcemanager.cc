@@ -0,0 +1,151 @@
+#include <iostream>
+#include <vector>
+#include <future>
+#include <memory>
+#include <sys/resource.h>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include "threadpoolfinal.h"
+using namespace std;
+
+/*
+进程里面有多个线程池，每个都按CPU核数的几倍创建线程：
+1、不共享预算：所有线程池的线程同时抢CPU，频繁的上下文切换
+2、共享ResourceManager：同时执行任务的线程数不超过CPU核数
+3、嵌套：线程池A的任务等待线程池B的结果，B的任务借用A的令牌执行，直接future.get()也不会死锁；waitFor等待期间把令牌让给别人
+4、cached模式：线程在等待令牌时不会为排队的任务继续创建新线程
+*/
+const int POOL_SIZE = 4;
+const int THREADS_PER_POOL = 8;
+const int TASKS_PER_POOL = 200;
+
+//每个任务扫描一块256KB的缓冲区，线程太多时缓存被互相挤掉
+unsigned long long work(const vector<unsigned>& buf) {
+    unsigned long long sum = 0;
+    for(int r = 0; r < 4; r++) {
+        for(unsigned v : buf) {
+            sum = sum * 31 + v;
+        }
+    }
+    return sum;
+}
+
+//读取/proc/self/status中的线程数量
+int threadCount() {
+    ifstream in("/proc/self/status");
+    string line;
+    while(getline(in, line)) {
+        if(line.compare(0, 8, "Threads:") == 0) {
+            return stoi(line.substr(8));
+        }
+    }
+    return 0;
+}
+
+void run(const char* name, ResourceManager* manager) {
+    rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    auto begin = chrono::steady_clock::now();
+    {
+        vector<unique_ptr<ThreadPool>> pools;
+        vector<vector<unsigned>> bufs(POOL_SIZE * THREADS_PER_POOL, vector<unsigned>(64 * 1024, 1));
+        vector<future<unsigned long long>> results;
+        for(int p = 0; p < POOL_SIZE; p++) {
+            pools.emplace_back(make_unique<ThreadPool>());
+            pools.back() -> setTaskQueMaxThreshHold(TASKS_PER_POOL);
+            if(manager != nullptr) {
+                pools.back() -> setResourceManager(*manager);
+            }
+            pools.back() -> start(THREADS_PER_POOL);
+        }
+        for(int i = 0; i < TASKS_PER_POOL; i++) {
+            for(int p = 0; p < POOL_SIZE; p++) {
+                const vector<unsigned>& buf = bufs[(p * THREADS_PER_POOL + i) % bufs.size()];
+                results.push_back(pools[p] -> submitTask(work, cref(buf)));
+            }
+        }
+        for(auto& f : results) {
+            f.get();
+        }
+    }
+    getrusage(RUSAGE_SELF, &after);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+    cout << name << ": " << ms << " ms, involuntary context switches "
+         << after.ru_nivcsw - before.ru_nivcsw << endl;
+}
+
+int main() {
+    cout << POOL_SIZE << " pools x " << THREADS_PER_POOL << " threads, "
+         << thread::hardware_concurrency() << " cores" << endl;
+    run("without manager", nullptr);
+    ResourceManager manager(thread::hardware_concurrency());
+    run("with manager   ", &manager);
+
+    //嵌套：outer的任务等待inner的结果，两个线程池共享1个令牌
+    ResourceManager single(1);
+    ThreadPool outer, inner;
+    outer.setResourceManager(single);
+    inner.setResourceManager(single);
+    outer.start(2);
+    inner.start(2);
+    future<int> r = outer.submitTask([&]() {
+        future<int> f = inner.submitTask([]() {return 42;});
+        return ResourceManager::waitFor(f); //等待期间把令牌让给inner
+    });
+    int nested = r.get();
+    cout << "nested pools with 1 token: " << nested << endl;
+
+    //多层嵌套，每层直接future.get()：令牌全部被等待中的外层任务占着，内层任务借用令牌执行
+    const int depth = 4;
+    ResourceManager two(2);
+    vector<unique_ptr<ThreadPool>> chain;
+    for(int i = 0; i < depth; i++) {
+        chain.push_back(make_unique<ThreadPool>());
+        chain[i] -> setResourceManager(two);
+        chain[i] -> start(2);
+    }
+    function<int(int, int)> call = [&](int level, int value) -> int {
+        if(level == depth) {
+            return value;
+        }
+        return chain[level] -> submitTask(call, level + 1, value + 1).get();
+    };
+    //最多等10秒，死锁时直接退出
+    thread watchdog([]() {
+        this_thread::sleep_for(chrono::seconds(10));
+        cout << "nested chain deadlocked" << endl;
+        _exit(1);
+    });
+    watchdog.detach();
+    vector<future<int>> chainResults;
+    for(int i = 0; i < 4; i++) {
+        chainResults.push_back(chain[0] -> submitTask(call, 1, i * 100));
+    }
+    bool chainOk = true;
+    for(int i = 0; i < 4; i++) {
+        chainOk = chainResults[i].get() == i * 100 + depth - 1 && chainOk;
+    }
+    cout << "nested chain of " << depth << " pools with 2 tokens and plain get(): " << (chainOk ? "ok" : "FAILED") << endl;
+
+    //cached模式的线程池只有1个令牌：线程数量不超过令牌总数，等待令牌的线程不取任务，也不会触发创建新线程
+    int before = threadCount();
+    int peak = 0;
+    {
+        ThreadPool cached;
+        cached.setMode(PoolMode::MODE_CACHED);
+        cached.setTaskQueMaxThreshHold(1024);
+        cached.setResourceManager(single);
+        cached.start(1);
+        vector<future<void>> results;
+        for(int i = 0; i < 50; i++) {
+            results.push_back(cached.submitTask([]() {this_thread::sleep_for(chrono::milliseconds(2));}));
+            peak = max(peak, threadCount() - before);
+        }
+        for(auto& f : results) {
+            f.get();
+        }
+    }
+    cout << "cached pool with 1 token: peak new threads " << peak << endl;
+    return nested == 42 && chainOk && peak <= 2 ? 0 : 1;
+}
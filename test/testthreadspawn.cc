@@ -0,0 +1,103 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <future>
+#include "threadpoolfinal.h"
+using namespace std;
+
+/*
+cached模式一次突发创建100个线程：
+1、默认属性(8MB栈)和256KB栈 + 栈缓存的创建延迟
+2、100个线程同时存在时进程的VmRSS/VmSize
+3、多余线程被回收后再次突发，复用缓存中的栈
+*/
+const int THREAD_SIZE = 100;
+
+//读取/proc/self/status中的一项，单位kB
+long procStatus(const string& key) {
+    ifstream in("/proc/self/status");
+    string line;
+    while(getline(in, line)) {
+        if(line.compare(0, key.size(), key) == 0) {
+            return stol(line.substr(key.size() + 1));
+        }
+    }
+    return 0;
+}
+
+//单纯的线程创建+join延迟
+double spawnLatency(const ThreadAttr& attr, int rounds) {
+    auto begin = chrono::steady_clock::now();
+    for(int r = 0; r < rounds; r++) {
+        vector<unique_ptr<Thread>> threads;
+        for(int i = 0; i < THREAD_SIZE; i++) {
+            threads.emplace_back(make_unique<Thread>([](int) {}, attr));
+            threads.back() -> start();
+        }
+    }
+    auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+    return (double)us / (rounds * THREAD_SIZE);
+}
+
+//让cached模式的线程池突发到THREAD_SIZE个线程，返回所有任务开始执行的耗时(ms)
+double burst(ThreadPool& pool) {
+    atomic_int started(0);
+    promise<void> release;
+    shared_future<void> gate = release.get_future().share();
+    vector<future<void>> results;
+    auto begin = chrono::steady_clock::now();
+    for(int i = 0; i < THREAD_SIZE; i++) {
+        results.push_back(pool.submitTask([&started, gate]() {
+            started++;
+            gate.wait();
+        }));
+    }
+    while(started < THREAD_SIZE) {
+        this_thread::yield();
+    }
+    double ms = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count() / 1000.0;
+    cout << "  burst to " << THREAD_SIZE << " threads: " << ms << " ms, VmRSS "
+         << procStatus("VmRSS:") << " kB, VmSize " << procStatus("VmSize:") << " kB" << endl;
+    release.set_value();
+    for(auto& f : results) {
+        f.get();
+    }
+    return ms;
+}
+
+void runPool(const char* name, size_t stackSize) {
+    cout << name << endl;
+    ThreadPool pool;
+    pool.setMode(PoolMode::MODE_CACHED);
+    pool.setTaskQueMaxThreshHold(1024);
+    pool.setThreadSizeThreshHold(THREAD_SIZE + 1);
+    pool.setThreadStackSize(stackSize);
+    pool.setThreadName("spawn");
+    pool.setThreadMaxIdleTime(1);
+    pool.start(1);
+    burst(pool);
+    //等待多余的线程空闲超时被回收
+    this_thread::sleep_for(chrono::seconds(3));
+    cout << "  after reap: VmRSS " << procStatus("VmRSS:") << " kB, VmSize " << procStatus("VmSize:") << " kB" << endl;
+    burst(pool);
+}
+
+//VmSize会受到glibc自己的栈缓存和malloc arena影响，可以用参数default/small在单独的进程里面分别测试
+int main(int argc, char** argv) {
+    string which = argc > 1 ? argv[1] : "";
+    ThreadAttr defaultAttr;
+    ThreadAttr smallAttr;
+    smallAttr.stackSize = 256 * 1024;
+    if(which != "small") {
+        runPool("cached pool, default stack", 0);
+    }
+    if(which != "default") {
+        runPool("cached pool, 256KB stack", 256 * 1024);
+    }
+
+    spawnLatency(smallAttr, 1); //预热栈缓存
+    cout << "spawn+join latency, default stack: " << spawnLatency(defaultAttr, 20) << " us/thread" << endl;
+    cout << "spawn+join latency, 256KB cached stack: " << spawnLatency(smallAttr, 20) << " us/thread" << endl;
+}